@@ -1,132 +1,337 @@
 #pragma once
 #include "math/Vec2.hpp"
+#include "math/SatKernels.hpp"
 #include "structures/AABB.hpp"
 #include "Mesh.hpp"
 #include <limits>
 #include <vector>
 #include <cmath>
 #include <array>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
 
 
 // collide: number of contact points (0 means no collision)
 // normal: collision normal pointing from body A to B
 // depth: penetration depth along normal
 // contact: up to two contact points
+// id: feature id of each contact point, equal across steps while the same features touch
+//     (see polyPoly / circlePoly for the encoding)
 struct CollisionResult 
 {
     int collide;
     Vec2 normal;
     float depth;
     std::array<Vec2, 2> contact;
+    std::array<uint32_t, 2> id;
 };
 
-// Body: rigid-body state and collision helpers.
-// meshID == 1000 is treated as a circle using meshdata::RADIUS (special case).
-struct Body
+// One contact point of a ContactConstraint
+struct ContactPoint
 {
-    Vec2 position;
-    Vec2 correction;
-    Vec2 velocity;
-    Vec2 acceleration;
-    float invMass;
-    float scale;
-    float theta, omega, alpha;
-    float cosTheta, sinTheta;
-    float invMoI;
-    AABB aabb; int ind, level;
-    std::vector<Vec2> transformed;
-    int meshID;
+    uint32_t id; // feature id, matches warm starting impulses across steps
+    Vec2 r1, r2; // contact point relative to each body's position
+    float normalMass, tangentMass;
+    float velocityBias; // restitution target for the normal relative velocity
+    float normalImpulse, tangentImpulse; // accumulated over the solver iterations
+};
+
+// Iterative solver state of one colliding pair, built from its CollisionResult every step
+struct ContactConstraint
+{
+    Vec2 normal;
+    float depth;
+    float mus, muk;
+    int count;
+    std::array<ContactPoint, 2> points;
+};
+
+// Accumulated impulses of a colliding pair, kept from one step to the next for warm starting
+struct CachedManifold
+{
+    uint64_t key; // id1 << 32 | id2, in collision pair order
+    int count;
+    std::array<uint32_t, 2> id;
+    std::array<float, 2> normalImpulse, tangentImpulse;
+};
 
+struct Body;
+
+// BodyInfo: per-body data that the per-step integration loops never touch
+// (shape, material, grid placement and the body's slice of the vertex pool).
+struct BodyInfo
+{
+    int meshID;
+    ShapeType shape; // type of meshdata::meshes[meshID], cached for the narrowphase dispatch
+    float scale;
     float restitution;
     float sFriction, kFriction;
-    int active;
+    int ind, level, slot;
+    int vertOffset, vertCount;
+    int normOffset;
+    int vertCap; // vertex capacity of the body's pool slice
+};
+static_assert(std::is_trivially_copyable_v<BodyInfo>);
+
+// BodyStorage: structure-of-arrays storage for every body of a World.
+// Hot per-step state (kinematics, trig cache, mass, AABB, flags) lives in separate
+// contiguous arrays indexed by body id, so integration and broadphase passes only
+// stream the fields they read. Cold data is kept in `info`.
+// active: 0 = deleted, 1 = dynamic (awake), 2 = static, 3 = sleeping (dynamic at rest).
+//
+// World-space polygon vertices of all bodies share one contiguous pool (`vertices`),
+// sliced per body by info.vertOffset/vertCount. Rotated edge normals are stored as
+// separate x / y arrays (`normalX`/`normalY`) at info.normOffset, padded to
+// sat::SAT_LANES so the SIMD SAT kernels can load them directly.
+// Slices are stable: a body keeps its slice while it exists (a reused id keeps it when it is
+// large enough), so static and sleeping bodies are never re-transformed. The pools only grow
+// when new bodies are placed.
+struct BodyStorage
+{
+    std::vector<Vec2> position;
+    std::vector<Vec2> correction;
+    std::vector<Vec2> velocity;
+    std::vector<Vec2> acceleration;
+    std::vector<float> theta, omega;
+    std::vector<float> cosTheta, sinTheta;
+    std::vector<float> invMass, invMoI;
+    std::vector<AABB> aabb;
+    std::vector<int> active;
+    std::vector<float> sleepTime; // seconds spent below the sleep velocity thresholds
+    std::vector<BodyInfo> info;
+
+    std::vector<Vec2> vertices;
+    std::vector<float> normalX, normalY;
+    int vertexUsed = 0;
+    int normalUsed = 0;
+
+    int size() const { return (int)active.size(); }
+
+    // Gives body `id` a slice of the pools sized for its mesh (circles get none),
+    // unless its current slice is already large enough.
+    void allocVertices(int id)
+    {
+        BodyInfo& inf = info[id];
+        if(inf.vertCount <= inf.vertCap)
+            return;
+        inf.vertCap = inf.vertCount;
+        inf.vertOffset = vertexUsed;
+        inf.normOffset = normalUsed;
+        vertexUsed += inf.vertCount;
+        normalUsed += sat::paddedCount(inf.vertCount);
+        if(vertexUsed > (int)vertices.size())
+            vertices.resize(std::max(vertexUsed, 2 * (int)vertices.size()));
+        if(normalUsed > (int)normalX.size())
+        {
+            int cap = std::max(normalUsed, 2 * (int)normalX.size());
+            normalX.resize(cap);
+            normalY.resize(cap);
+        }
+    }
 
-    Body(const Vec2& pos, const Vec2& vel, int mid, float imass, float iMoI, float sc, float ang, float res, int act = 1)
+    // Appends a new body at id == size().
+    void emplace_back(const Vec2& pos, const Vec2& vel, int mid, float imass, float iMoI, float sc, float ang, float res, int act = 1)
     {
-        position = pos;
-        correction = Vec2(0, 0);
-        velocity = vel;
-        acceleration = Vec2(0, 0);
-        invMass = imass;
-        scale = sc;
-        theta = ang;
-        cosTheta = std::cos(ang), sinTheta = std::sin(ang);
-        omega = alpha = 0;
-        invMoI = iMoI;
-        aabb = AABB();
-        ind = -1;
-        level = -1;
-        meshID = mid;
-        active = act;
-        restitution = res;
-        sFriction = 0.3;
-        kFriction = 0.2;
+        position.emplace_back();
+        correction.emplace_back();
+        velocity.emplace_back();
+        acceleration.emplace_back();
+        theta.emplace_back();
+        omega.emplace_back();
+        cosTheta.emplace_back();
+        sinTheta.emplace_back();
+        invMass.emplace_back();
+        invMoI.emplace_back();
+        aabb.emplace_back();
+        active.emplace_back();
+        sleepTime.emplace_back();
+        info.emplace_back();
+        set(size() - 1, pos, vel, mid, imass, iMoI, sc, ang, res, act);
     }
 
-    // Fills transformed with mesh vertex positions rotated by theta, scaled and translated to position.
-    void transform()
+    // Resizes every per-body array to `n` bodies (new entries are zeroed / default constructed)
+    void resize(int n)
     {
-        transformed.clear();
-        std::vector<Vec2>& points = meshdata::meshes[meshID].points;
-        for(Vec2& point: points)
-            transformed.push_back(Vec2::rotate(point * scale, cosTheta, sinTheta) + position);
+        position.resize(n);
+        correction.resize(n);
+        velocity.resize(n);
+        acceleration.resize(n);
+        theta.resize(n);
+        omega.resize(n);
+        cosTheta.resize(n);
+        sinTheta.resize(n);
+        invMass.resize(n);
+        invMoI.resize(n);
+        aabb.resize(n);
+        active.resize(n);
+        sleepTime.resize(n);
+        info.resize(n);
+    }
+
+    // (Re)initializes the body stored at `id`.
+    void set(int id, const Vec2& pos, const Vec2& vel, int mid, float imass, float iMoI, float sc, float ang, float res, int act = 1)
+    {
+        position[id] = pos;
+        correction[id] = Vec2(0, 0);
+        velocity[id] = vel;
+        acceleration[id] = Vec2(0, 0);
+        theta[id] = ang;
+        omega[id] = 0;
+        cosTheta[id] = std::cos(ang), sinTheta[id] = std::sin(ang);
+        invMass[id] = imass;
+        invMoI[id] = iMoI;
+        aabb[id] = AABB();
+        active[id] = act;
+        sleepTime[id] = 0;
+
+        BodyInfo& inf = info[id];
+        inf.meshID = mid;
+        inf.scale = sc;
+        inf.restitution = res;
+        inf.sFriction = 0.3;
+        inf.kFriction = 0.2;
+        inf.ind = -1;
+        inf.level = -1;
+        inf.slot = -1;
+        inf.shape = meshdata::meshes[mid].type;
+        inf.vertCount = (int)meshdata::meshes[mid].points.size();
+    }
+
+    Body operator[](int id);
+};
+
+// Body: accessor for one body in a BodyStorage, plus the rigid-body collision helpers.
+// Cheap to copy (storage pointer + id); all accessors return references into the arrays.
+// The body's shape (circle, box or polygon) comes from its mesh.
+struct Body
+{
+    BodyStorage* s;
+    int id;
+
+    Vec2& position() const { return s->position[id]; }
+    Vec2& correction() const { return s->correction[id]; }
+    Vec2& velocity() const { return s->velocity[id]; }
+    Vec2& acceleration() const { return s->acceleration[id]; }
+    float& theta() const { return s->theta[id]; }
+    float& omega() const { return s->omega[id]; }
+    float& cosTheta() const { return s->cosTheta[id]; }
+    float& sinTheta() const { return s->sinTheta[id]; }
+    float& invMass() const { return s->invMass[id]; }
+    float& invMoI() const { return s->invMoI[id]; }
+    AABB& aabb() const { return s->aabb[id]; }
+    int& active() const { return s->active[id]; }
+
+    int& meshID() const { return s->info[id].meshID; }
+    float& scale() const { return s->info[id].scale; }
+    float& restitution() const { return s->info[id].restitution; }
+    float& sFriction() const { return s->info[id].sFriction; }
+    float& kFriction() const { return s->info[id].kFriction; }
+    int& ind() const { return s->info[id].ind; }
+    int& level() const { return s->info[id].level; }
+
+    // World-space vertices / rotated normals of this body inside the storage pools.
+    Vec2* transformed() const { return s->vertices.data() + s->info[id].vertOffset; }
+    float* normalX() const { return s->normalX.data() + s->info[id].normOffset; }
+    float* normalY() const { return s->normalY.data() + s->info[id].normOffset; }
+    Vec2 normal(int i) const { return Vec2(normalX()[i], normalY()[i]); }
+    int vertexCount() const { return s->info[id].vertCount; }
+
+    // Circle shape (meshdata::addCircle): scaled radius
+    float radius() const { return meshdata::meshes[meshID()].radius * scale(); }
+
+    // Box shape (meshdata::addBox): scaled half-extents and the rotated local axes,
+    // which are the normals of faces 1 (+x) and 2 (+y)
+    ShapeType shape() const { return s->info[id].shape; }
+    bool isBox() const { return shape() == ShapeType::Box; }
+    Vec2 halfExtents() const { return meshdata::meshes[meshID()].halfExtents * scale(); }
+    Vec2 axisX() const { return Vec2(cosTheta(), sinTheta()); }
+    Vec2 axisY() const { return Vec2(-sinTheta(), cosTheta()); }
+
+    // Fills the body's pool slices with mesh vertex positions rotated by theta, scaled and
+    // translated to position, and with the mesh normals rotated by theta (padding lanes
+    // repeat normal 0).
+    void transform() const
+    {
+        const Mesh& mesh = meshdata::meshes[meshID()];
+        Vec2* tf = transformed();
+        float* nx = normalX();
+        float* ny = normalY();
+        int n = vertexCount();
+        float sc = scale(), ct = cosTheta(), st = sinTheta();
+        Vec2 pos = position();
+        for(int i = 0; i < n; i++)
+        {
+            tf[i] = Vec2::rotate(mesh.points[i] * sc, ct, st) + pos;
+            Vec2 rn = Vec2::rotate(mesh.normals[i], ct, st);
+            nx[i] = rn.x;
+            ny[i] = rn.y;
+        }
+        for(int i = n; i < sat::paddedCount(n); i++)
+        {
+            nx[i] = nx[0];
+            ny[i] = ny[0];
+        }
     }
 
     // Computes axis-aligned bounding box for the body, by calling transform.
-    void calculateAABB()
+    void calculateAABB() const
     {
-        if (meshID == 1000) 
+        if (shape() == ShapeType::Circle) 
         { 
-            const float radius = meshdata::RADIUS * scale; 
+            const float radius = this->radius(); 
     
-            Vec2 minPos = position - Vec2(radius, radius);
-            Vec2 maxPos = position + Vec2(radius, radius);
+            Vec2 minPos = position() - Vec2(radius, radius);
+            Vec2 maxPos = position() + Vec2(radius, radius);
     
-            aabb = AABB(minPos, maxPos);
+            aabb() = AABB(minPos, maxPos);
             return;
         }
     
         transform();
-        Vec2 minPos = position;
-        Vec2 maxPos = position;
+        Vec2 minPos = position();
+        Vec2 maxPos = position();
+        const Vec2* tf = transformed();
     
-        for (const Vec2& tp : transformed) 
+        for (int i = 0; i < vertexCount(); i++) 
         {
-            minPos = Vec2::min(minPos, tp);
-            maxPos = Vec2::max(maxPos, tp);
+            minPos = Vec2::min(minPos, tf[i]);
+            maxPos = Vec2::max(maxPos, tf[i]);
         }
     
-        aabb = AABB(minPos, maxPos);
+        aabb() = AABB(minPos, maxPos);
     }
 
     //Projects the transformed polygon onto `axis` and returns min/max projection.
     void projectOntoAxis(const Vec2& axis, float& mn, float& mx) const {
         mn = std::numeric_limits<float>::infinity();
         mx = -std::numeric_limits<float>::infinity();
+        const Vec2* tf = transformed();
+        int n = vertexCount();
     
-        for (const Vec2& tp : transformed) 
+        for (int i = 0; i < n; i++) 
         {
-            float project = Vec2::dot(tp, axis);
+            float project = Vec2::dot(tf[i], axis);
             mn = std::min(project, mn);
             mx = std::max(project, mx);
         }
     }
 
-    // Point-in-polygon test for transformed polygon
+    // Point-in-polygon test for transformed polygon, against the pooled rotated normals
     bool contains(Vec2 point) const
     {
-        if(meshID == 1000)
+        if(shape() == ShapeType::Circle)
         {
-            Vec2 dist = point - position;
-            float r = meshdata::RADIUS * scale;
+            Vec2 dist = point - position();
+            float r = radius();
             return Vec2::dot(dist, dist) <= r*r;
         }
 
-        std::vector<Vec2>& norms = meshdata::meshes[meshID].normals;
-        for(int i = 0; i < transformed.size(); i++)
+        const Vec2* tf = transformed();
+        for(int i = 0; i < vertexCount(); i++)
         {
-            Vec2 norm = Vec2::rotate(norms[i], cosTheta, sinTheta);
-            if(Vec2::dot(point, norm) > Vec2::dot(transformed[i], norm))
+            Vec2 norm = normal(i);
+            if(Vec2::dot(point, norm) > Vec2::dot(tf[i], norm))
                 return false;
         }
         return true;
@@ -135,9 +340,9 @@ struct Body
     // circle circle SAT collision check
     static CollisionResult circleCircle(const Body& b1, const Body& b2)
     {
-        Vec2 distVec = b2.position - b1.position;
+        Vec2 distVec = b2.position() - b1.position();
         float dsqr = Vec2::dot(distVec, distVec);
-        float rsum = meshdata::RADIUS * (b1.scale + b2.scale);
+        float rsum = b1.radius() + b2.radius();
         float rsqr = rsum * rsum;
 
         if(dsqr > rsqr)
@@ -150,326 +355,520 @@ struct Body
         float depth = rsum - d;
 
         CollisionResult res = {1, normal, depth};
-        res.contact[0] = b1.position + normal * meshdata::RADIUS * b1.scale;
+        res.contact[0] = b1.position() + normal * b1.radius();
         return res;
     } 
     
-    // circle polygon SAT collision check
+    // circle polygon collision check by closest feature, reading the polygon's pooled vertices and normals
+    // One pass finds the face the circle center is furthest in front of; the center's Voronoi region
+    // along that face then decides between the face and one of its end vertices.
+    // Feature id: poly << 8 | index of the closest face (poly 1) or polygon vertex (poly 2)
     static CollisionResult circlePoly(const Body& b1, const Body& b2)
     {
-        float minOverlap = std::numeric_limits<float>::infinity();
-        Vec2 normal;
-        int poly;
-
-        std::vector<Vec2>& normals = meshdata::meshes[b1.meshID].normals;
-
-        for (const Vec2& norm : normals) {
-            Vec2 rnorm = Vec2::rotate(norm, b1.cosTheta, b1.sinTheta);
-            float min1, max1, min2, max2;
-            b1.projectOntoAxis(rnorm, min1, max1);
-            float center = Vec2::dot(b2.position, rnorm);
-
-            min2 = center - meshdata::RADIUS * b2.scale;
-            max2 = center + meshdata::RADIUS * b2.scale;
-
-            float overlap = max1 - min2;
-
-            if (overlap <= 0) {
-                return {0}; 
+        const Vec2* tf = b1.transformed();
+        int n = b1.vertexCount();
+        Vec2 center = b2.position();
+        float radius = b2.radius();
+
+        int face = 0;
+        float separation = -std::numeric_limits<float>::infinity();
+        for (int i = 0; i < n; i++) {
+            float sep = Vec2::dot(center - tf[i], b1.normal(i));
+            if (sep > radius) {
+                return {0};
             }
-
-            if (overlap < minOverlap) {
-                minOverlap = overlap;
-                normal = rnorm;
-                poly = 1;
+            if (sep > separation) {
+                separation = sep;
+                face = i;
             }
         }
 
-        for (const Vec2& tp : b1.transformed) {
-            float min1, max1, min2, max2;
-            Vec2 norm = (tp - b2.position).normalized();
-            
-            b1.projectOntoAxis(norm, min1, max1);
-            float center = Vec2::dot(b2.position, norm);
-
-            min2 = center - meshdata::RADIUS * b2.scale;
-            max2 = center + meshdata::RADIUS * b2.scale;
-
-            float overlap = max2 - min1;
-
-            if (overlap <= 0) {
-                return {0};
-            }
-
-            if (overlap < minOverlap) {
-                minOverlap = overlap;
-                normal = norm;
+        Vec2 normal = b1.normal(face);
+        float depth = radius - separation;
+        int poly = 1, feature = face;
+
+        // The center is outside the polygon: beyond either end of the face, the closest feature is that vertex
+        if (separation > 0) {
+            int next = face + 1 < n ? face + 1 : 0;
+            const Vec2& v1 = tf[face];
+            const Vec2& v2 = tf[next];
+            int vertex = -1;
+            if (Vec2::dot(center - v1, v2 - v1) <= 0)
+                vertex = face;
+            else if (Vec2::dot(center - v2, v1 - v2) <= 0)
+                vertex = next;
+
+            if (vertex >= 0) {
+                Vec2 d = center - tf[vertex];
+                float dsqr = Vec2::dot(d, d);
+                if (dsqr > radius * radius) {
+                    return {0};
+                }
+                float dist = std::sqrt(dsqr);
+                normal = d * (1.0f / dist);
+                depth = radius - dist;
                 poly = 2;
+                feature = vertex;
             }
         }
 
-        CollisionResult res = {1, normal, minOverlap};
-        if(poly == 1)
-            res.contact[0] = b2.position - normal * meshdata::RADIUS * b2.scale;
-        else
-            res.contact[0] = b2.position + normal * meshdata::RADIUS * b2.scale;
-        
+        CollisionResult res = {1, normal, depth};
+        res.id[0] = poly << 8 | feature;
+        res.contact[0] = center - normal * radius;
         return res;
     }
 
-    // Sutherland–Hodgman style clipping for a segment against a half-space (n·x >= c).
-    // `pts` should contain two points (segment endpoints). After call it may contain 0,1,2 points.
-    static void clip(std::vector<Vec2>& pts, const Vec2& n, float c) {
-        Vec2 A = pts[0];
-        Vec2 B = pts[1];
-    
-        float dA = Vec2::dot(A, n) - c;
-        float dB = Vec2::dot(B, n) - c;
-    
-        Vec2 out0, out1;
-        int count = 0;
-  
-        if (dA >= 0.0f) {
-            out0 = A;
-            count = 1;
-        }
+    // Clips the incident edge a -> b to the reference face's side planes lo <= tangent·p <= hi in
+    // one step (tangent = normal rotated by +90 degrees) and keeps the clipped points below the
+    // reference face (normal·p < rd) as contacts. An endpoint outside the slab moves along the edge
+    // to the side plane it is beyond, and is dropped if the edge does not reach that plane before
+    // the other endpoint. Written with selects only, as the outcome is unpredictable per pair.
+    // Clip vertex feature: 0 / 1 for the endpoints a / b, 2 / 3 for crossings of the lo / hi plane.
+    static CollisionResult clipIncidentEdge(const Vec2& a, const Vec2& b, const Vec2& normal, float lo, float hi,
+                                            float rd, uint32_t edges, float depth)
+    {
+        Vec2 tangent = Vec2(-normal.y, normal.x);
+        const Vec2 p[2] = {a, b};
+        const float s[2] = {Vec2::dot(tangent, a), Vec2::dot(tangent, b)};
 
-        if (dA * dB < 0.0f) {
-            float t = dA / (dA - dB);
-            Vec2  I = A + (B - A) * t;
-            if (count == 0) {
-                out0 = I;
-                count = 1;
-            } else {
-                out1 = I;
-                count = 2;
-            }
+        CollisionResult res;
+        int cnt = 0;
+        for (int k = 0; k < 2; k++)
+        {
+            float plane = std::clamp(s[k], lo, hi);
+            bool inside = plane == s[k];
+            // Fraction of the way to the other endpoint where the edge meets the plane
+            float t = inside ? 0.0f : (plane - s[k]) / (s[1 - k] - s[k]);
+            Vec2 q = p[k] + (p[1 - k] - p[k]) * t;
+            uint32_t feature = inside ? (uint32_t)k : s[k] < lo ? 2u : 3u;
+            res.contact[cnt] = q;
+            res.id[cnt] = edges | feature;
+            cnt += t >= 0.0f && t < 1.0f && rd - Vec2::dot(q, normal) > 0;
         }
 
-        if (dB >= 0.0f) {
-            if (count == 0) {
-                out0 = B;
-                count = 1;
-            } else {
-                out1 = B;
-                count = 2;
-            }
-        }
+        res.collide = cnt;
+        res.normal = normal;
+        res.depth = depth;
+        return res;
+    }
 
-        pts.clear();
-        if (count >= 1) pts.push_back(out0);
-        if (count == 2) pts.push_back(out1);
+    // Reference polygon choice of the face-clipping kernels (polyPoly, boxPoly, boxBox): the body
+    // with the higher id only provides the reference face when its overlap is clearly the smaller
+    // one (Box2D's k_relativeTol / k_absoluteTol). In resting stacks the two overlaps are nearly
+    // equal, and a strict comparison would flip the reference polygon from step to step and change
+    // every contact feature id. Deciding by id rather than argument order keeps swapped kernels,
+    // polyPoly and either pair orientation on the same reference face.
+    static bool secondIsReference(const Body& b1, const Body& b2, float overlap1, float overlap2)
+    {
+        if (b1.id < b2.id)
+            return overlap2 < 0.98f * overlap1 - 0.001f;
+        return !(overlap1 < 0.98f * overlap2 - 0.001f);
     }
 
     // polygon polygon SAT collision check
+    // Face overlaps of both polygons are computed by the SIMD kernel in sat::faceOverlaps,
+    // reading world-space vertices and padded rotated normals from the pools.
     static CollisionResult polyPoly(const Body& b1, const Body& b2)
     {
-        float minOverlap = std::numeric_limits<float>::infinity();
-        Vec2 normal;
-        int poly, rid;
-
-        int N1 = b1.transformed.size();
-        int N2 = b2.transformed.size();
-
-        int id = 0;
-        for (const Vec2& norm : meshdata::meshes[b1.meshID].normals) {
-            Vec2 rnorm = Vec2::rotate(norm, b1.cosTheta, b1.sinTheta);
-            float min1, max1, min2, max2;
+        int N1 = b1.vertexCount();
+        int N2 = b2.vertexCount();
+        const Vec2* v1 = b1.transformed();
+        const Vec2* v2 = b2.transformed();
+
+        float overlap1, overlap2;
+        int rid1 = sat::faceOverlaps(b1.normalX(), b1.normalY(), N1, v1, N1, v2, N2, overlap1);
+        if (rid1 < 0) {
+            return {0};
+        }
+        int rid2 = sat::faceOverlaps(b2.normalX(), b2.normalY(), N2, v2, N2, v1, N1, overlap2);
+        if (rid2 < 0) {
+            return {0};
+        }
 
-            b1.projectOntoAxis(rnorm, min1, max1);
-            b2.projectOntoAxis(rnorm, min2, max2);
-            float overlap = max1 - min2;
-    
-            if (overlap <= 0) {
-                return {0};
-            }
-    
-            if (overlap < minOverlap) {
-                minOverlap = overlap;
-                normal = rnorm;
-                rid = id;
-                poly = 1;
-            }
+        if (secondIsReference(b1, b2, overlap1, overlap2))
+            return faceContacts(b1, b2, 2, rid2, overlap2);
+        return faceContacts(b1, b2, 1, rid1, overlap1);
+    }
 
-            id++;
+    // Face of `b` whose normal is most anti-parallel to `n` (first one on ties).
+    // Boxes only compare `n` against their two axes.
+    static int incidentFace(const Body& b, const Vec2& n)
+    {
+        if (b.isBox()) {
+            float dx = Vec2::dot(n, b.axisX());
+            float dy = Vec2::dot(n, b.axisY());
+            // Candidates are -dx (face 3), dx (1), dy (2), -dy (0)
+            int fx = dx > 0 ? 3 : 1, fy = dy > 0 ? 0 : 2;
+            float ax = std::abs(dx), ay = std::abs(dy);
+            if (ax != ay)
+                return ax > ay ? fx : fy;
+            return std::min(fx, fy);
         }
 
-        id = 0;
-        for (const Vec2& norm : meshdata::meshes[b2.meshID].normals) {
-            Vec2 rnorm = Vec2::rotate(norm, b2.cosTheta, b2.sinTheta);
-            float min1, max1, min2, max2;
-
-            b1.projectOntoAxis(rnorm, min1, max1);
-            b2.projectOntoAxis(rnorm, min2, max2);
-            float overlap = max2 - min1;
-    
-            if (overlap <= 0) {
-                return {0};
-            }
-    
-            if (overlap < minOverlap) {
-                minOverlap = overlap;
-                normal = rnorm;
-                rid = id;
-                poly = 2;
+        int iid = 0;
+        float anti = std::numeric_limits<float>::infinity();
+        for (int i = 0; i < b.vertexCount(); i++)
+        {
+            float dot = Vec2::dot(n, b.normal(i));
+            if (dot < anti)
+            {
+                anti = dot;
+                iid = i;
             }
-
-            id++;
         }
+        return iid;
+    }
 
-        Vec2 r1, r2, i1, i2;
+    // Contact points of two overlapping polygons once the reference face is known: face `rid` of
+    // b1 (poly 1) or b2 (poly 2), with penetration `depth` along its normal. The most anti-parallel
+    // face of the other polygon is clipped against the reference face's side planes, and clipped
+    // points below the reference face become contacts.
+    // Feature id: poly << 24 | reference edge << 16 | incident edge << 8 | clip vertex feature
+    static CollisionResult faceContacts(const Body& b1, const Body& b2, int poly, int rid, float depth)
+    {
+        const Body& ref = poly == 1 ? b1 : b2;
+        const Body& inc = poly == 1 ? b2 : b1;
+        const Vec2* vr = ref.transformed();
+        const Vec2* vi = inc.transformed();
 
-        if(poly == 1)
-        {
-            r1 = b1.transformed[rid];
-            r2 = b1.transformed[(rid + 1) % N1];
+        Vec2 normal = ref.normal(rid);
+        Vec2 tangent = Vec2(-normal.y, normal.x);
+        const Vec2& r1 = vr[rid];
+        const Vec2& r2 = vr[rid + 1 < ref.vertexCount() ? rid + 1 : 0];
+        int iid = incidentFace(inc, normal);
+        uint32_t edges = (uint32_t)poly << 24 | (uint32_t)(rid & 0xFF) << 16 | (uint32_t)(iid & 0xFF) << 8;
+        return clipIncidentEdge(vi[iid], vi[iid + 1 < inc.vertexCount() ? iid + 1 : 0], normal,
+                                Vec2::dot(tangent, r1), Vec2::dot(tangent, r2), Vec2::dot(r1, normal), edges, depth);
+    }
 
-            float anti = std::numeric_limits<float>::infinity();
-            int iid;
+    // faceContacts for a box reference face (boxBox, and boxPoly when the box is the reference): the
+    // side planes and the face offset come from the reference box's center and half-extents (face rid
+    // spans the x half-extent for rid 0 / 2, the y half-extent for 1 / 3), the incident face of a box
+    // from the axis test. Same contacts and feature ids.
+    static CollisionResult boxFaceContacts(const Body& b1, const Body& b2, int poly, int rid, float depth)
+    {
+        const Body& ref = poly == 1 ? b1 : b2;
+        const Body& inc = poly == 1 ? b2 : b1;
+        const Vec2* vi = inc.transformed();
 
-            std::vector<Vec2>& antiNorms = meshdata::meshes[b2.meshID].normals;
+        Vec2 normal = ref.normal(rid);
+        Vec2 tangent = Vec2(-normal.y, normal.x);
+        Vec2 h = ref.halfExtents();
+        float ht = rid & 1 ? h.y : h.x, hn = rid & 1 ? h.x : h.y;
+        float tc = Vec2::dot(tangent, ref.position());
+        int iid = incidentFace(inc, normal);
+        uint32_t edges = (uint32_t)poly << 24 | (uint32_t)rid << 16 | (uint32_t)(iid & 0xFF) << 8;
+        return clipIncidentEdge(vi[iid], vi[iid + 1 < inc.vertexCount() ? iid + 1 : 0], normal, tc - ht, tc + ht,
+                                Vec2::dot(normal, ref.position()) + hn, edges, depth);
+    }
 
-            for(int i = 0; i < N2; i++)
-            {
-                Vec2 anorm = Vec2::rotate(antiNorms[i], b2.cosTheta, b2.sinTheta);
-                float dot = Vec2::dot(normal, anorm);
-                if(dot < anti)
-                {
-                    anti = dot;
-                    iid = i;
-                }
+    // Face overlaps of a box (center projections cx / cy on its axes, half-extents h) with a shape
+    // spanning [minX, maxX] x [minY, maxY] on the same axes, as sat::faceOverlaps would compute them
+    // over faces 0..3. Returns the face of the smallest overlap (first one on ties), or -1 if separated.
+    static int boxFaceOverlaps(float cx, float cy, const Vec2& h, float minX, float maxX, float minY, float maxY, float& minOverlap)
+    {
+        float overlap[4] = {
+            maxY - (cy - h.y), // 0: -y
+            cx + h.x - minX,   // 1: +x
+            cy + h.y - minY,   // 2: +y
+            maxX - (cx - h.x), // 3: -x
+        };
+        int best = -1;
+        minOverlap = std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 4; i++) {
+            if (overlap[i] <= 0)
+                return -1;
+            if (overlap[i] < minOverlap) {
+                minOverlap = overlap[i];
+                best = i;
             }
+        }
+        return best;
+    }
 
-            i1 = b2.transformed[iid];
-            i2 = b2.transformed[(iid + 1) % N2];
+    // box box SAT collision check: two axes per box, each projected as center +- radius
+    static CollisionResult boxBox(const Body& b1, const Body& b2)
+    {
+        Vec2 d = b2.position() - b1.position();
+        Vec2 h1 = b1.halfExtents(), h2 = b2.halfExtents();
+        Vec2 x1 = b1.axisX(), y1 = b1.axisY();
+        Vec2 x2 = b2.axisX(), y2 = b2.axisY();
+        float xx = std::abs(Vec2::dot(x1, x2)), xy = std::abs(Vec2::dot(x1, y2));
+        float yx = std::abs(Vec2::dot(y1, x2)), yy = std::abs(Vec2::dot(y1, y2));
+
+        // Each box in its own frame (center at 0) against the other box's center projection +- its
+        // projection radius |a·x| * hx + |a·y| * hy
+        float cx = Vec2::dot(x1, d), cy = Vec2::dot(y1, d);
+        float rx = h2.x * xx + h2.y * xy, ry = h2.x * yx + h2.y * yy;
+        float overlap1, overlap2;
+        int rid1 = boxFaceOverlaps(0, 0, h1, cx - rx, cx + rx, cy - ry, cy + ry, overlap1);
+        if (rid1 < 0) {
+            return {0};
+        }
+        cx = -Vec2::dot(x2, d), cy = -Vec2::dot(y2, d);
+        rx = h1.x * xx + h1.y * yx, ry = h1.x * xy + h1.y * yy;
+        int rid2 = boxFaceOverlaps(0, 0, h2, cx - rx, cx + rx, cy - ry, cy + ry, overlap2);
+        if (rid2 < 0) {
+            return {0};
         }
-        else
-        {
-            r1 = b2.transformed[rid];
-            r2 = b2.transformed[(rid + 1) % N2];
 
-            float anti = std::numeric_limits<float>::infinity();
-            int iid;
+        if (secondIsReference(b1, b2, overlap1, overlap2))
+            return boxFaceContacts(b1, b2, 2, rid2, overlap2);
+        return boxFaceContacts(b1, b2, 1, rid1, overlap1);
+    }
 
-            std::vector<Vec2>& antiNorms = meshdata::meshes[b1.meshID].normals;
+    // box polygon SAT collision check: the polygon is projected on both box axes in one pass,
+    // the polygon's own faces go through sat::faceOverlaps
+    static CollisionResult boxPoly(const Body& b1, const Body& b2)
+    {
+        int N2 = b2.vertexCount();
+        const Vec2* v2 = b2.transformed();
+        Vec2 h = b1.halfExtents();
+        Vec2 x = b1.axisX(), y = b1.axisY();
+
+        float minX = std::numeric_limits<float>::infinity(), maxX = -minX, minY = minX, maxY = -minX;
+        for (int i = 0; i < N2; i++) {
+            float px = Vec2::dot(x, v2[i]), py = Vec2::dot(y, v2[i]);
+            minX = std::min(minX, px), maxX = std::max(maxX, px);
+            minY = std::min(minY, py), maxY = std::max(maxY, py);
+        }
 
-            for(int i = 0; i < N1; i++)
-            {
-                Vec2 anorm = Vec2::rotate(antiNorms[i], b1.cosTheta, b1.sinTheta);
-                float dot = Vec2::dot(normal, anorm);
-                if(dot < anti)
-                {
-                    anti = dot;
-                    iid = i;
-                }
-            }
+        float overlap1;
+        int rid1 = boxFaceOverlaps(Vec2::dot(x, b1.position()), Vec2::dot(y, b1.position()), h, minX, maxX, minY, maxY, overlap1);
+        if (rid1 < 0) {
+            return {0};
+        }
 
-            i1 = b1.transformed[iid];
-            i2 = b1.transformed[(iid + 1) % N1];
+        float overlap2;
+        int rid2 = sat::faceOverlaps(b2.normalX(), b2.normalY(), N2, v2, N2, b1.transformed(), 4, overlap2);
+        if (rid2 < 0) {
+            return {0};
         }
 
-        Vec2 tangent = Vec2(-normal.y, normal.x);
-        std::vector<Vec2> pts = {i1, i2};
-        clip(pts,  tangent, Vec2::dot(tangent, r1));
-        clip(pts, -tangent, -Vec2::dot(tangent, r2));
+        if (secondIsReference(b1, b2, overlap1, overlap2))
+            return faceContacts(b1, b2, 2, rid2, overlap2);
+        return boxFaceContacts(b1, b2, 1, rid1, overlap1);
+    }
 
-        float rd = Vec2::dot(r1, normal);
-        CollisionResult res;
+    // box circle collision check in the box's frame: the circle center is clamped to the box.
+    // Same results and feature ids as circlePoly.
+    static CollisionResult boxCircle(const Body& b1, const Body& b2)
+    {
+        Vec2 h = b1.halfExtents();
+        Vec2 x = b1.axisX(), y = b1.axisY();
+        Vec2 center = b2.position();
+        float radius = b2.radius();
+        Vec2 rel = center - b1.position();
+        float px = Vec2::dot(rel, x), py = Vec2::dot(rel, y);
+        float ex = std::abs(px) - h.x, ey = std::abs(py) - h.y; // distances outside the box faces
+
+        if (ex > radius || ey > radius) {
+            return {0};
+        }
 
-        int cnt = 0;
-        for(int i = 0; i < pts.size(); i++)
-        {
-            float depth = rd - Vec2::dot(pts[i], normal);
-            if(depth > 0)
-            {
-                res.contact[cnt] = pts[i];
-                cnt++;
+        Vec2 normal;
+        float depth;
+        int poly, feature;
+        if (ex > 0 && ey > 0) {
+            // Corner region
+            float dsqr = ex * ex + ey * ey;
+            if (dsqr > radius * radius) {
+                return {0};
+            }
+            float dist = std::sqrt(dsqr);
+            normal = (x * std::copysign(ex, px) + y * std::copysign(ey, py)) * (1.0f / dist);
+            depth = radius - dist;
+            poly = 2;
+            feature = py < 0 ? (px < 0 ? 0 : 1) : (px < 0 ? 3 : 2);
+        } else {
+            // Face region or inside: the face the center is furthest in front of
+            poly = 1;
+            if (ex > ey) {
+                normal = px < 0 ? -x : x;
+                depth = radius - ex;
+                feature = px < 0 ? 3 : 1;
+            } else {
+                normal = py < 0 ? -y : y;
+                depth = radius - ey;
+                feature = py < 0 ? 0 : 2;
             }
         }
 
-        res.collide = cnt;
-        res.normal = normal;
-        res.depth = minOverlap;
+        CollisionResult res = {1, normal, depth};
+        res.id[0] = poly << 8 | feature;
+        res.contact[0] = center - normal * radius;
         return res;
     }
 
-    // Dispatches to the correct SAT helper based on meshID.
-    // Ensures returned normal is oriented from b1 -> b2.
-    static CollisionResult performSAT(const Body& b1, const Body& b2)
+    using Narrowphase = CollisionResult (*)(const Body&, const Body&);
+
+    // Runs F with the bodies swapped, for the pairs whose kernel expects the other shape first
+    template <Narrowphase F>
+    static CollisionResult swapped(const Body& b1, const Body& b2) { return F(b2, b1); }
+
+    // Narrowphase routine for a pair of shape types, from a table built at compile time
+    static Narrowphase narrowphase(ShapeType t1, ShapeType t2)
     {
-        CollisionResult res;
-        if(b1.meshID == 1000 && b2.meshID == 1000)
-            res = circleCircle(b1, b2);
-        else if(b1.meshID == 1000)
-            res = circlePoly(b2, b1);
-        else if(b2.meshID == 1000)
-            res = circlePoly(b1, b2);
-        else
-            res = polyPoly(b1, b2);
-        
+        constexpr int N = (int)ShapeType::Count;
+        static constexpr Narrowphase table[N][N] = {
+            // Circle                  Box                   Polygon
+            { circleCircle,            swapped<boxCircle>,   swapped<circlePoly> }, // Circle
+            { boxCircle,               boxBox,               boxPoly },             // Box
+            { circlePoly,              swapped<boxPoly>,     polyPoly },            // Polygon
+        };
+        return table[(int)t1][(int)t2];
+    }
+
+    // Runs `collide` (the narrowphase routine for the pair's shape types) and orients the returned
+    // normal from b1 -> b2.
+    static CollisionResult performSAT(const Body& b1, const Body& b2, Narrowphase collide)
+    {
+        CollisionResult res = collide(b1, b2);
         if(!res.collide)
             return res;
         
-        if(Vec2::dot(b2.position - b1.position, res.normal) < 0) 
+        if(Vec2::dot(b2.position() - b1.position(), res.normal) < 0) 
             res.normal = -res.normal;
         
         return res;
     }
 
-    // Applies normal impulse and friction impulse to velocities and angular velocities.
-    // Uses Baumgarte-like positional correction with `corrFactor` and `slop`.
-    static void resolve(Body& b1, Body& b2, const CollisionResult& res, float corrFactor = 0.40f, float slop = 0.05f)
-    {   
-        Vec2 corr = res.normal * corrFactor * (std::max(res.depth - slop, 0.0f) / (b1.invMass + b2.invMass));
-        b1.correction -= corr * b1.invMass;
-        b2.correction += corr * b2.invMass;
+    // Dispatches to the narrowphase routine of the pair's shape types (circle, box or polygon).
+    // Ensures returned normal is oriented from b1 -> b2.
+    static CollisionResult performSAT(const Body& b1, const Body& b2)
+    {
+        return performSAT(b1, b2, narrowphase(b1.shape(), b2.shape()));
+    }
 
-        for(int i = 0; i < res.collide; i++)
+    // Fills the solver state of a colliding pair: contact arms, effective masses along the normal
+    // and tangent, and the restitution target (only for approach speeds above restitutionThreshold,
+    // so resting contacts do not bounce). Accumulated impulses start from the `cached` impulses of
+    // points with the same feature id, or at zero.
+    static void prepareContact(const Body& b1, const Body& b2, const CollisionResult& res, ContactConstraint& cc, float restitutionThreshold, const CachedManifold* cached)
+    {
+        cc.normal = res.normal;
+        cc.depth = res.depth;
+        cc.count = res.collide;
+        cc.mus = std::sqrt(b1.sFriction() * b2.sFriction());
+        cc.muk = std::sqrt(b1.kFriction() * b2.kFriction());
+        float e = std::min(b1.restitution(), b2.restitution());
+
+        const float im1 = b1.invMass(), im2 = b2.invMass();
+        const float iI1 = b1.invMoI(), iI2 = b2.invMoI();
+        const Vec2 tangent = Vec2(-res.normal.y, res.normal.x);
+        for(int i = 0; i < cc.count; i++)
         {
-            Vec2 r1 = res.contact[i] - b1.position;
-            Vec2 r2 = res.contact[i] - b2.position;
-
-            Vec2 v1 = b1.velocity + Vec2(-r1.y, r1.x) * b1.omega;
-            Vec2 v2 = b2.velocity + Vec2(-r2.y, r2.x) * b2.omega;
-
-            Vec2 rVel = v2 - v1;
-            float velNorm = Vec2::dot(rVel, res.normal);
-            if(velNorm >= 0)
-                continue;
-            
-            float iMag = -(1.0f + std::min(b1.restitution, b2.restitution)) * velNorm;
-
-            float c1 = Vec2::cross(r1, res.normal);
-            float c2 = Vec2::cross(r2, res.normal);
-
-            iMag /= (b1.invMass + b2.invMass + b1.invMoI * c1*c1 + b2.invMoI * c2*c2);
-            Vec2 impulse = res.normal * iMag;
-
-            float mus = std::sqrt(b1.sFriction * b2.sFriction);
-            float muk = std::sqrt(b1.kFriction * b2.kFriction);
-
-            float fS = iMag * mus;
-            float fK = iMag * muk;
-            Vec2 tangent = Vec2(-res.normal.y, res.normal.x);
-            float velTang = Vec2::dot(rVel, tangent);
-
-            float t1 = Vec2::cross(r1, tangent);
-            float t2 = Vec2::cross(r2, tangent);
-            float fMag = -velTang / (b1.invMass + b2.invMass + b1.invMoI * t1*t1 + b2.invMoI * t2*t2);
-            
-            if(fMag > fS)
-                fMag = fK;
-            else if(fMag < -fS)
-                fMag = -fK;
+            ContactPoint& p = cc.points[i];
+            p.id = res.id[i];
+            p.r1 = res.contact[i] - b1.position();
+            p.r2 = res.contact[i] - b2.position();
+
+            float c1 = Vec2::cross(p.r1, res.normal), c2 = Vec2::cross(p.r2, res.normal);
+            p.normalMass = 1.0f / (im1 + im2 + iI1 * c1*c1 + iI2 * c2*c2);
+            float t1 = Vec2::cross(p.r1, tangent), t2 = Vec2::cross(p.r2, tangent);
+            p.tangentMass = 1.0f / (im1 + im2 + iI1 * t1*t1 + iI2 * t2*t2);
+
+            Vec2 v1 = b1.velocity() + Vec2(-p.r1.y, p.r1.x) * b1.omega();
+            Vec2 v2 = b2.velocity() + Vec2(-p.r2.y, p.r2.x) * b2.omega();
+            float velNorm = Vec2::dot(v2 - v1, res.normal);
+            p.velocityBias = velNorm < -restitutionThreshold ? -e * velNorm : 0.0f;
+
+            p.normalImpulse = 0.0f;
+            p.tangentImpulse = 0.0f;
+            for(int k = 0; cached && k < cached->count; k++)
+            {
+                if(cached->id[k] == p.id)
+                {
+                    p.normalImpulse = cached->normalImpulse[k];
+                    p.tangentImpulse = cached->tangentImpulse[k];
+                    break;
+                }
+            }
+        }
+    }
 
-            impulse += tangent * fMag;
+    // Applies the accumulated impulses taken over by prepareContact, so the velocity iterations
+    // start from last step's solution instead of from rest.
+    static void warmStart(const Body& b1, const Body& b2, const ContactConstraint& cc)
+    {
+        const Vec2 tangent = Vec2(-cc.normal.y, cc.normal.x);
+        for(int i = 0; i < cc.count; i++)
+        {
+            const ContactPoint& p = cc.points[i];
+            applyImpulse(b1, b2, p, cc.normal * p.normalImpulse + tangent * p.tangentImpulse);
+        }
+    }
 
-            b1.velocity -= impulse * b1.invMass;
-            b2.velocity += impulse * b2.invMass;
+    // Applies `impulse` at contact point `p` (negated on b1); only dynamic bodies are written to
+    static void applyImpulse(const Body& b1, const Body& b2, const ContactPoint& p, const Vec2& impulse)
+    {
+        if(b1.active() == 1)
+        {
+            b1.velocity() -= impulse * b1.invMass();
+            b1.omega() -= b1.invMoI() * Vec2::cross(p.r1, impulse);
+        }
+        if(b2.active() == 1)
+        {
+            b2.velocity() += impulse * b2.invMass();
+            b2.omega() += b2.invMoI() * Vec2::cross(p.r2, impulse);
+        }
+    }
 
-            b1.omega -= b1.invMoI * Vec2::cross(r1, impulse);
-            b2.omega += b2.invMoI * Vec2::cross(r2, impulse);
+    // One sequential-impulse pass over the contact points: friction first, then the normal.
+    // The accumulated normal impulse is clamped to be non-negative; the accumulated friction impulse
+    // stays inside the static cone (mus * normal impulse) and drops to kinetic friction once it
+    // would leave it. Only dynamic bodies are written to, so contacts that share a static body
+    // can be solved in parallel.
+    static void solveVelocity(const Body& b1, const Body& b2, ContactConstraint& cc)
+    {
+        const Vec2 normal = cc.normal;
+        const Vec2 tangent = Vec2(-normal.y, normal.x);
+        auto relativeVelocity = [&](const ContactPoint& p) {
+            Vec2 v1 = b1.velocity() + Vec2(-p.r1.y, p.r1.x) * b1.omega();
+            Vec2 v2 = b2.velocity() + Vec2(-p.r2.y, p.r2.x) * b2.omega();
+            return v2 - v1;
+        };
+
+        for(int i = 0; i < cc.count; i++)
+        {
+            ContactPoint& p = cc.points[i];
+
+            float velTang = Vec2::dot(relativeVelocity(p), tangent);
+            float newTang = p.tangentImpulse - velTang * p.tangentMass;
+            float maxStatic = cc.mus * p.normalImpulse;
+            if(newTang > maxStatic)
+                newTang = cc.muk * p.normalImpulse;
+            else if(newTang < -maxStatic)
+                newTang = -cc.muk * p.normalImpulse;
+            applyImpulse(b1, b2, p, tangent * (newTang - p.tangentImpulse));
+            p.tangentImpulse = newTang;
+
+            float velNorm = Vec2::dot(relativeVelocity(p), normal);
+            float newNorm = std::max(p.normalImpulse + p.normalMass * (p.velocityBias - velNorm), 0.0f);
+            applyImpulse(b1, b2, p, normal * (newNorm - p.normalImpulse));
+            p.normalImpulse = newNorm;
         }
     }
+
+    // One position pass: pushes the bodies apart along the contact normal through their
+    // `correction`. The remaining penetration is the SAT depth minus the corrections already
+    // applied along the normal, so repeated passes converge instead of overshooting.
+    static void solvePosition(const Body& b1, const Body& b2, const ContactConstraint& cc, float corrFactor, float slop)
+    {
+        const float im1 = b1.invMass(), im2 = b2.invMass();
+        float depth = cc.depth - Vec2::dot(b2.correction() - b1.correction(), cc.normal);
+        if(depth <= slop)
+            return;
+        Vec2 corr = cc.normal * corrFactor * ((depth - slop) / (im1 + im2));
+        if(b1.active() == 1)
+            b1.correction() -= corr * im1;
+        if(b2.active() == 1)
+            b2.correction() += corr * im2;
+    }
 };
 
+
+inline Body BodyStorage::operator[](int id)
+{
+    return Body{this, id};
+}
@@ -1,10 +1,16 @@
 #pragma once
 #include <thread>
 #include <vector>
+#include <mutex>
 #include <atomic>
 #include <barrier>
+#include <latch>
 #include <chrono>
+#include <array>
+#include <algorithm>
+#include <bit>
 #include "World.hpp"
+#include "Trace.hpp"
 
 struct Engine
 {
@@ -12,26 +18,114 @@ struct Engine
     int nThreads;
     std::atomic<bool> stopFlag{false};
 
-    enum class TaskType { Gather, SAT };
-    struct Task { TaskType type; int t, a, b; };
+    enum class TaskType {
+        Gather, SAT, Histogram, Scatter, Prepare, WarmStart, Velocity, Position, Island,
+        ResetForces, Integrate, Correct,
+    };
+    // Trace zone names, indexed by TaskType
+    static constexpr const char* TASK_NAMES[] = {
+        "Gather", "SAT", "Histogram", "Scatter", "Prepare", "WarmStart", "Velocity", "Position", "Island",
+        "ResetForces", "Integrate", "Correct",
+    };
+
+    // Work is cut into fixed blocks of GATHER_GRAIN body ids / SAT_GRAIN pairs (in satOrder) / SORT_GRAIN sort keys
+    // (Histogram, Scatter) / RESOLVE_GRAIN contacts (Prepare, WarmStart, Velocity, Position) /
+    // ISLAND_GRAIN islands / BODY_GRAIN body ids (ResetForces, Integrate, Correct).
+    // A task is a range of blocks; owners split it lazily and thieves take the largest pending ones.
+    static constexpr int BODY_GRAIN = 1024;
+    static constexpr int GATHER_GRAIN = 64;
+    static constexpr int SAT_GRAIN = 64;
+    static constexpr int SORT_GRAIN = 4096;
+    static constexpr int RESOLVE_GRAIN = 32;
+    static constexpr int ISLAND_GRAIN = 4;
+    struct Task { int begin, end; };
+
+    // Per-worker deque: the owner pushes / pops at the back, thieves steal from the front.
+    // A ring buffer that only grows, so steps do not allocate once it is large enough.
+    struct WorkQueue
+    {
+        std::mutex m;
+        std::vector<Task> ring = std::vector<Task>(64); // power of two
+        int head = 0, size = 0;
+
+        bool empty() const { return size == 0; }
+
+        void pushBack(const Task& t)
+        {
+            int mask = (int)ring.size() - 1;
+            if (size == (int)ring.size())
+            {
+                std::vector<Task> bigger(2 * ring.size());
+                for (int k = 0; k < size; ++k)
+                    bigger[k] = ring[(head + k) & mask];
+                ring.swap(bigger);
+                head = 0;
+                mask = (int)ring.size() - 1;
+            }
+            ring[(head + size++) & mask] = t;
+        }
+
+        Task popBack() { return ring[(head + --size) & ((int)ring.size() - 1)]; }
+
+        Task popFront()
+        {
+            Task t = ring[head];
+            head = (head + 1) & ((int)ring.size() - 1);
+            --size;
+            return t;
+        }
+    };
 
     std::vector<std::thread> workers;
+    std::vector<WorkQueue> queues;
+    // Gather output per block, concatenated in block order so the pair order
+    // does not depend on which worker ran which block
     std::vector<std::vector<std::pair<int,int>>> results;
-    std::vector<std::vector<Task>> tasks;
+
+    // Radix sort of the collision pairs in deterministic mode: 8-bit digits, one histogram per block
+    static constexpr int RADIX_BITS = 8;
+    static constexpr int RADIX = 1 << RADIX_BITS;
+    std::vector<std::array<int, RADIX>> histograms; // digit counts per block, then scatter offsets
+    std::vector<uint64_t> sortKeys, sortTemp;
+    int sortShift = 0; // digit of the current pass
+
+    // SAT phase input: collision pair indices grouped by the shape types of the pair, so that every
+    // block runs one narrowphase routine over homogeneous runs of pairs. Results still go to the
+    // pair's own index, so the pair order seen by the solver does not change.
+    static constexpr int SHAPE_PAIRS = (int)ShapeType::Count * (int)ShapeType::Count;
+    std::vector<int> satOrder;
+    std::vector<uint8_t> satBucket; // shape pair of every collision pair
+    std::array<int, SHAPE_PAIRS + 1> satStart{}; // bucket b owns satOrder[satStart[b], satStart[b+1])
+
+    TaskType phase = TaskType::Gather;
+    int phaseCount = 0, phaseGrain = 1;
+    int phaseBase = 0; // WarmStart / Velocity / Position: offset of the current color batch in world->colorOrder
+    float phaseDt = 0.0f; // Integrate: time step
+    Vec2 phaseGravity; // ResetForces: acceleration every body starts the step with
+    std::atomic<int> remaining{0}; // blocks not yet executed in the current phase
 
     std::barrier<> startBarrier;
     std::barrier<> finishBarrier;
 
+    // The calling thread is the one that steps the engine and is traced as "main"
     Engine(int threadCount, World* w)
         : world(w),
           nThreads(threadCount),
+          queues(threadCount),
           startBarrier(nThreads + 1),
           finishBarrier(nThreads + 1)
     {
-        tasks.resize(nThreads);
-        results.resize(nThreads);
+        tracing::setThreadName("main");
+        // Every worker registers its trace buffer before the constructor returns, so that a later
+        // tracing::start() allocates all of them instead of a worker doing it inside a step
+        std::latch registered(nThreads);
         for (int i = 0; i < nThreads; ++i)
-            workers.emplace_back([this, i]{ workerLoop(i); });
+            workers.emplace_back([this, i, &registered]{
+                tracing::setThreadName("worker " + std::to_string(i));
+                registered.count_down();
+                workerLoop(i);
+            });
+        registered.wait();
     }
 
     ~Engine() {
@@ -44,44 +138,105 @@ struct Engine
     void updateStep(float dt, float& tu, float& tc, float& tr)
     {
         using clock = std::chrono::high_resolution_clock;
+        tracing::Zone stepZone("Step");
         auto t0 = clock::now();
 
-        world->updateVelocities(dt);
-        world->updatePositions(dt);
-        world->initGrid();
-        auto t1 = clock::now();
+        // The pair buffers below grow along with the world's
+        if (world->reserveBuffers())
+        {
+            size_t pairs = (size_t)world->reservedBodies * World::PAIRS_PER_BODY;
+            satOrder.reserve(pairs);
+            satBucket.reserve(pairs);
+            sortKeys.reserve(pairs);
+            sortTemp.reserve(pairs);
+            histograms.reserve(pairs / SORT_GRAIN + 1);
+        }
 
-        // Phase 1: Broadphase
-        clearTasks();
-        int cur = 0;
-        for(int id = 0; id < world->allocated; id++)
-            if (world->bodies[id].active)
-                tasks[cur++ % nThreads].push_back({TaskType::Gather, -1, id, -1});
+        phaseDt = dt;
+        runPhase(TaskType::Integrate, world->allocated, BODY_GRAIN);
+        {
+            tracing::Zone zone("Broadphase");
+            world->updateBroadphase();
+        }
+        auto t1 = clock::now();
 
-        startBarrier.arrive_and_wait();
-        finishBarrier.arrive_and_wait();
+        // Phase 1: Broadphase (sweep and prune maintains its pair list in updateBroadphase)
+        // Only pairs with an awake body need the narrowphase
+        if (world->broadphase == Broadphase::SweepAndPrune)
+        {
+            const int* active = world->bodies.active.data();
+            tracing::Zone zone("Gather");
+            world->collisionPairs.clear();
+            for (auto [a, b] : world->sap.pairs)
+                if (active[a] == 1 || active[b] == 1)
+                    world->collisionPairs.emplace_back(a, b);
+        }
+        else
+        {
+            int blocks = (world->allocated + GATHER_GRAIN - 1) / GATHER_GRAIN;
+            if ((int)results.size() < blocks)
+                results.resize(blocks);
+            runPhase(TaskType::Gather, world->allocated, GATHER_GRAIN);
 
-        world->collisionPairs.clear();
-        for (auto& r : results) 
-            world->collisionPairs.insert(world->collisionPairs.end(), r.begin(), r.end());
+            world->collisionPairs.clear();
+            for (int b = 0; b < blocks; ++b)
+                world->collisionPairs.insert(world->collisionPairs.end(), results[b].begin(), results[b].end());
+        }
+        if (world->deterministic)
+        {
+            tracing::Zone zone("Sort");
+            sortPairs();
+        }
         auto t2 = clock::now();
 
         // Phase 2: Narrowphase
         int N = (int)world->collisionPairs.size();
         world->collisionData.resize(N);
-        clearTasks();
-        for (int i = 0; i < N; ++i)
+        world->constraints.resize(N);
         {
-            auto [a,b] = world->collisionPairs[i];
-            tasks[i % nThreads].push_back({TaskType::SAT, i, a, b});
+            tracing::Zone zone("Bucket");
+            bucketPairs();
         }
+        runPhase(TaskType::SAT, N, SAT_GRAIN);
 
-        startBarrier.arrive_and_wait();
-        finishBarrier.arrive_and_wait();
-
-        world->resolveCollisions();
-        world->applyCorrections();
-        world->resetGrid();
+        // Phase 3: Resolve
+        tracing::Zone resolveZone("Resolve");
+        world->wakeContacts();
+        if (world->resolveMode == ResolveMode::Islands)
+        {
+            // Islands share no dynamic body, so each one runs every solver iteration on a single worker
+            {
+                tracing::Zone zone("BuildIslands");
+                world->buildIslands();
+            }
+            runPhase(TaskType::Island, world->numIslands, ISLAND_GRAIN);
+        }
+        else
+        {
+            // Every iteration walks the color batches in order; contacts within a batch share no dynamic body
+            {
+                tracing::Zone zone("Color");
+                world->colorContacts();
+            }
+            runPhase(TaskType::Prepare, world->colCnt, RESOLVE_GRAIN);
+            if (world->warmStarting)
+                solveColors(TaskType::WarmStart);
+            for (int it = 0; it < world->velocityIterations; ++it)
+                solveColors(TaskType::Velocity);
+            for (int it = 0; it < world->positionIterations; ++it)
+                solveColors(TaskType::Position);
+        }
+        {
+            tracing::Zone zone("Manifolds");
+            world->storeManifolds();
+        }
+        {
+            tracing::Zone zone("Sleep");
+            if (world->sleepEnabled && world->resolveMode != ResolveMode::Islands)
+                world->buildIslands();
+            world->updateSleep(dt);
+        }
+        runPhase(TaskType::Correct, world->allocated, BODY_GRAIN);
         auto t3 = clock::now();
 
         tu = std::chrono::duration<float, std::micro>(t1 - t0).count();
@@ -89,32 +244,300 @@ struct Engine
         tr = std::chrono::duration<float, std::micro>(t3 - t2).count();
     }
 
+    // World::resetForces run on the workers; call it before applying this step's forces
+    void resetForces(const Vec2& g)
+    {
+        phaseGravity = g;
+        runPhase(TaskType::ResetForces, world->allocated, BODY_GRAIN);
+    }
+
+    // Puts collisionPairs in canonical order: each pair as (min id, max id), sorted by that tuple
+    // with a parallel LSD radix sort. Every pass histograms the blocks in parallel, turns the
+    // counts into per-(digit, block) offsets serially and scatters in parallel; blocks keep their
+    // order within a digit, so the sort is stable and the result independent of the thread count.
+    void sortPairs()
+    {
+        auto& pairs = world->collisionPairs;
+        int n = (int)pairs.size();
+        if (n == 0)
+            return;
+        const int bits = std::bit_width((unsigned)std::max(world->allocated - 1, 1));
+        const uint64_t mask = ((uint64_t)1 << bits) - 1;
+        sortKeys.resize(n);
+        sortTemp.resize(n);
+        for (int i = 0; i < n; ++i)
+        {
+            auto [a, b] = pairs[i];
+            sortKeys[i] = (uint64_t)std::min(a, b) << bits | (uint64_t)std::max(a, b);
+        }
+
+        int blocks = (n + SORT_GRAIN - 1) / SORT_GRAIN;
+        if ((int)histograms.size() < blocks)
+            histograms.resize(blocks);
+        for (sortShift = 0; sortShift < 2 * bits; sortShift += RADIX_BITS)
+        {
+            runPhase(TaskType::Histogram, n, SORT_GRAIN);
+            int sum = 0;
+            for (int d = 0; d < RADIX; ++d)
+                for (int b = 0; b < blocks; ++b)
+                {
+                    int c = histograms[b][d];
+                    histograms[b][d] = sum;
+                    sum += c;
+                }
+            runPhase(TaskType::Scatter, n, SORT_GRAIN);
+            sortKeys.swap(sortTemp);
+        }
+
+        for (int i = 0; i < n; ++i)
+            pairs[i] = {(int)(sortKeys[i] >> bits), (int)(sortKeys[i] & mask)};
+    }
+
+    // Counting sort of the collision pairs by (shape of first body, shape of second body) into satOrder
+    void bucketPairs()
+    {
+        const auto& pairs = world->collisionPairs;
+        const BodyInfo* info = world->bodies.info.data();
+        int n = (int)pairs.size();
+        satOrder.resize(n);
+        satBucket.resize(n);
+        std::array<int, SHAPE_PAIRS> count{};
+        for (int i = 0; i < n; ++i)
+        {
+            int b = (int)info[pairs[i].first].shape * (int)ShapeType::Count + (int)info[pairs[i].second].shape;
+            satBucket[i] = (uint8_t)b;
+            count[b]++;
+        }
+        satStart[0] = 0;
+        for (int b = 0; b < SHAPE_PAIRS; ++b)
+            satStart[b + 1] = satStart[b] + count[b];
+        std::array<int, SHAPE_PAIRS> cursor;
+        std::copy(satStart.begin(), satStart.end() - 1, cursor.begin());
+        for (int i = 0; i < n; ++i)
+            satOrder[cursor[satBucket[i]]++] = i;
+    }
+
+    // One solver pass over all color batches, then over the serially solved overflow bucket
+    void solveColors(TaskType type)
+    {
+        for (int c = 0; c < world->numColors; ++c)
+        {
+            phaseBase = world->colorStart[c];
+            runPhase(type, world->colorStart[c + 1] - phaseBase, RESOLVE_GRAIN);
+        }
+        for (int k = world->colorStart[World::MAX_COLORS]; k < world->colorStart[World::MAX_COLORS + 1]; ++k)
+            solveContact(type, world->colorOrder[k]);
+    }
+
+    // Deals `count` items in blocks of `grain` as one contiguous range per worker
+    // and runs the workers until every block is done. A single block is run on the calling thread.
+    void runPhase(TaskType type, int count, int grain)
+    {
+        int blocks = (count + grain - 1) / grain;
+        if (blocks == 0)
+            return;
+        tracing::Zone zone(TASK_NAMES[(int)type]);
+        phase = type;
+        phaseCount = count;
+        phaseGrain = grain;
+        if (blocks == 1)
+        {
+            runBlock(0);
+            return;
+        }
+        remaining.store(blocks, std::memory_order_relaxed);
+        for (int i = 0; i < nThreads; ++i)
+        {
+            Task t{(int)((long long)blocks * i / nThreads), (int)((long long)blocks * (i + 1) / nThreads)};
+            if (t.begin < t.end)
+                queues[i].pushBack(t);
+        }
+
+        startBarrier.arrive_and_wait();
+        finishBarrier.arrive_and_wait();
+    }
+
     void workerLoop(int i)
     {
-        auto& myTasks = tasks[i];
-        auto& myResults = results[i];
-        while (!stopFlag)
+        // Ticks at which the worker ran out of blocks and at which it left the finish barrier.
+        // The "Wait" (out of work until every worker is done) and "Idle" (serial work on the main
+        // thread) spans are only recorded once the next phase has started, so that the buffer is
+        // never written while the main thread may be writing the trace between steps.
+        uint64_t doneTicks = 0, finishTicks = 0;
+        // stopFlag is only checked after the start barrier, so a worker can never
+        // leave the loop without arriving at the barriers the destructor waits on
+        while (true)
         {
             startBarrier.arrive_and_wait();
+            if (doneTicks && tracing::enabled())
+            {
+                tracing::emit("Wait", doneTicks, finishTicks);
+                tracing::emit("Idle", finishTicks, tracing::now());
+            }
             // After main thread reaches start barrier, we can execute the tasks in parallel
             if (stopFlag) { finishBarrier.arrive_and_wait(); break; }
 
-            myResults.clear();
-            for (auto& t : myTasks)
-            {
-                if (t.type == TaskType::Gather)
-                    world->getNeighbors(t.a, myResults);
-                else
-                    world->collisionData[t.t] = Body::performSAT(world->bodies[t.a], world->bodies[t.b]);
-            }
+            doneTicks = runTasks(i);
             // Signal to the main thread that this worker thread has completed its task
             finishBarrier.arrive_and_wait();
+            if (doneTicks)
+                finishTicks = tracing::now();
+        }
+    }
+
+    // Executes blocks from the own deque, stealing when it runs dry, until the phase is done.
+    // While tracing, records the span from the first to the last executed block under the phase name
+    // and returns the ticks at which the worker ran out of blocks (0 when not tracing).
+    uint64_t runTasks(int i)
+    {
+        const bool trace = tracing::enabled();
+        uint64_t start = trace ? tracing::now() : 0, busyBegin = 0, busyEnd = start;
+        Task t;
+        while (remaining.load(std::memory_order_acquire) > 0)
+        {
+            if (!popLocal(i, t) && !steal(i, t))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if (trace && !busyBegin)
+                busyBegin = tracing::now();
+            // Keep the first block and leave the rest of the range where thieves can find it
+            while (t.end - t.begin > 1)
+            {
+                int mid = (t.begin + t.end) / 2;
+                {
+                    std::lock_guard<std::mutex> lock(queues[i].m);
+                    queues[i].pushBack({mid, t.end});
+                }
+                t.end = mid;
+            }
+            runBlock(t.begin);
+            remaining.fetch_sub(1, std::memory_order_release);
+            if (trace)
+                busyEnd = tracing::now();
         }
+        if (busyBegin)
+            tracing::emit(TASK_NAMES[(int)phase], busyBegin, busyEnd);
+        return busyEnd;
+    }
+
+    bool popLocal(int i, Task& t)
+    {
+        std::lock_guard<std::mutex> lock(queues[i].m);
+        if (queues[i].empty())
+            return false;
+        t = queues[i].popBack();
+        return true;
+    }
+
+    bool steal(int i, Task& t)
+    {
+        for (int k = 1; k < nThreads; ++k)
+        {
+            WorkQueue& victim = queues[(i + k) % nThreads];
+            std::lock_guard<std::mutex> lock(victim.m);
+            if (victim.empty())
+                continue;
+            t = victim.popFront();
+            return true;
+        }
+        return false;
+    }
+
+    void runBlock(int b)
+    {
+        int begin = b * phaseGrain;
+        int end = std::min(begin + phaseGrain, phaseCount);
+        if (phase == TaskType::Gather)
+        {
+            auto& out = results[b];
+            out.clear();
+            // Room for a few pairs per body up front, so blocks rarely grow once the world is running
+            if (out.capacity() == 0)
+                out.reserve(4 * GATHER_GRAIN);
+            for (int id = begin; id < end; ++id)
+                if (world->bodies.active[id])
+                    world->getNeighbors(id, out);
+        }
+        else if (phase == TaskType::SAT)
+        {
+            // A block can span several buckets: one loop with a fixed routine per bucket
+            int bucket = 0;
+            for (int k = begin; k < end; )
+            {
+                while (satStart[bucket + 1] <= k)
+                    bucket++;
+                Body::Narrowphase collide = Body::narrowphase((ShapeType)(bucket / (int)ShapeType::Count),
+                                                              (ShapeType)(bucket % (int)ShapeType::Count));
+                for (int stop = std::min(end, satStart[bucket + 1]); k < stop; ++k)
+                {
+                    int i = satOrder[k];
+                    auto [a, c] = world->collisionPairs[i];
+                    world->collisionData[i] = Body::performSAT(world->bodies[a], world->bodies[c], collide);
+                }
+            }
+        }
+        else if (phase == TaskType::Histogram)
+        {
+            auto& h = histograms[b];
+            h.fill(0);
+            for (int i = begin; i < end; ++i)
+                h[(sortKeys[i] >> sortShift) & (RADIX - 1)]++;
+        }
+        else if (phase == TaskType::Scatter)
+        {
+            auto& offset = histograms[b];
+            for (int i = begin; i < end; ++i)
+                sortTemp[offset[(sortKeys[i] >> sortShift) & (RADIX - 1)]++] = sortKeys[i];
+        }
+        else if (phase == TaskType::Prepare)
+        {
+            // Every colliding contact, in any order: preparation only writes the contact's own constraint
+            for (int k = begin; k < end; ++k)
+                world->prepareContact(world->colorOrder[k]);
+        }
+        else if (phase == TaskType::WarmStart || phase == TaskType::Velocity || phase == TaskType::Position)
+        {
+            for (int k = begin; k < end; ++k)
+                solveContact(phase, world->colorOrder[phaseBase + k]);
+        }
+        else if (phase == TaskType::Island)
+        {
+            for (int isl = begin; isl < end; ++isl)
+                solveIsland(isl);
+        }
+        else if (phase == TaskType::ResetForces)
+            world->resetForces(phaseGravity, begin, end);
+        else if (phase == TaskType::Integrate)
+            world->integrate(phaseDt, begin, end);
+        else
+            world->applyCorrections(begin, end);
+    }
+
+    void solveContact(TaskType type, int i)
+    {
+        if (type == TaskType::WarmStart)
+            world->warmStart(i);
+        else if (type == TaskType::Velocity)
+            world->solveVelocity(i);
+        else
+            world->solvePosition(i);
     }
 
-    void clearTasks()
+    void solveIsland(int isl)
     {
-        for (auto& t : tasks) t.clear();
-        for (auto& r : results) r.clear();
+        const int* order = world->islandOrder.data();
+        int begin = world->islandStart[isl], end = world->islandStart[isl + 1];
+        for (int k = begin; k < end; ++k)
+            world->prepareContact(order[k]);
+        for (int k = begin; world->warmStarting && k < end; ++k)
+            world->warmStart(order[k]);
+        for (int it = 0; it < world->velocityIterations; ++it)
+            for (int k = begin; k < end; ++k)
+                world->solveVelocity(order[k]);
+        for (int it = 0; it < world->positionIterations; ++it)
+            for (int k = begin; k < end; ++k)
+                world->solvePosition(order[k]);
     }
 };
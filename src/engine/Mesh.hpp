@@ -4,18 +4,30 @@
 #include <cassert>
 #include "math/Vec2.hpp"
 
+// Shape of a mesh; selects the narrowphase routine of a pair (see Body::narrowphase)
+enum class ShapeType : int { Circle, Box, Polygon, Count };
+
 // Represents a simple 2D convex polygon mesh.
 // Points must be in counter-clockwise order.
 // Automatically recenters points around the centroid.
 // Computes outward-facing edge normals.
+// A box mesh (meshdata::addBox) also keeps its half-extents; its points are the corners
+// (-x, -y), (x, -y), (x, y), (-x, y), so face i runs from corner i to corner i + 1 and
+// faces 0..3 face -y, +x, +y, -x. Box pairs use the dedicated kernels in Body.
+// A circle mesh (meshdata::addCircle) has no points, only a radius.
 struct Mesh {
     std::vector<Vec2> points;
     std::vector<Vec2> normals;      
+    ShapeType type = ShapeType::Polygon;
+    Vec2 halfExtents;
+    float radius = 0.0f;
 
     Mesh(const std::vector<Vec2> pnts)
     {
         points = pnts;
         int n = points.size();
+        if(n == 0)
+            return;
         Vec2 avg(0, 0);
         for(Vec2 p: points)
             avg += p;
@@ -46,9 +58,21 @@ struct Mesh {
 namespace meshdata
 {
     inline std::vector<Mesh> meshes;
-    inline const float RADIUS = 10.0f;
     inline int addMesh(const std::vector<Vec2>& pts) {
         meshes.emplace_back(pts);
         return meshes.size() - 1;
     }
+    // Axis-aligned rectangle centered on the origin, rotated with the body
+    inline int addBox(const Vec2& half) {
+        int id = addMesh({ Vec2(-half.x, -half.y), Vec2(half.x, -half.y), Vec2(half.x, half.y), Vec2(-half.x, half.y) });
+        meshes[id].type = ShapeType::Box;
+        meshes[id].halfExtents = half;
+        return id;
+    }
+    inline int addCircle(float radius) {
+        meshes.emplace_back(std::vector<Vec2>{});
+        meshes.back().type = ShapeType::Circle;
+        meshes.back().radius = radius;
+        return meshes.size() - 1;
+    }
 }
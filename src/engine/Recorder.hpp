@@ -0,0 +1,709 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <bit>
+#include <algorithm>
+#include <iterator>
+#include <numbers>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "World.hpp"
+
+// Frame recording: per-step body state (position, angle, velocity, active) streamed to a file.
+//
+// File layout: recording::Header, then one chunk per recorded frame (ChunkHeader + payload).
+// Every value is quantized to a fixed step (the header's quanta) and handled as an int32 track.
+// A keyframe stores every track of every body; all but the angle as differences to the previous
+// body. A delta frame stores residuals against a prediction from the previous frames (see
+// Predictor): per body a flag for "has residuals", then one residual per track. Motion residuals
+// smaller than one quantum are stored as zero (dead-band) and the prediction runs on the decoded
+// values, so the error stays below one quantum while resting, creeping and ballistic bodies cost
+// a fraction of a bit. Each payload is coded with an adaptive binary range coder whose models
+// restart at every keyframe. Keyframes every keyframeInterval frames bound how far a seek has to
+// decode.
+namespace recording
+{
+    constexpr uint32_t MAGIC = 0x524D534F; // "OSMR"
+    constexpr uint32_t VERSION = 2;
+    constexpr int TRACKS = 6; // x, y, angle, vx, vy, active
+    constexpr int ACTIVE = TRACKS - 1;
+    constexpr int ORDER[TRACKS] = {3, 4, 0, 1, 2, 5}; // coding order: velocity before position
+    constexpr double DEAD_BAND = 1.0; // quanta; smaller motion residuals are stored as zero
+    using Tracks = std::array<int32_t, TRACKS>;
+
+    struct Header
+    {
+        uint32_t magic, version;
+        float posQuantum, angleQuantum, velQuantum;
+        float dt; // seconds between recorded frames
+        int keyframeInterval;
+    };
+
+    struct ChunkHeader
+    {
+        uint32_t size; // payload bytes
+        uint32_t frame;
+        int bodyCount;
+        int keyframe;
+    };
+
+    // Binary range coder (LZMA style). Probabilities are 11-bit estimates of a 0 bit and move
+    // 1/32 of the way towards every coded bit.
+    constexpr int PROB_BITS = 11;
+    constexpr uint16_t PROB_INIT = 1 << (PROB_BITS - 1);
+    constexpr int ADAPT_SHIFT = 5;
+    constexpr uint32_t RANGE_TOP = 1u << 24;
+
+    struct RangeEncoder
+    {
+        std::vector<uint8_t>* out = nullptr;
+        uint64_t low = 0;
+        uint32_t range = 0xFFFFFFFF;
+        uint8_t cache = 0;
+        uint64_t cacheSize = 1;
+
+        void begin(std::vector<uint8_t>& buffer)
+        {
+            out = &buffer;
+            low = 0;
+            range = 0xFFFFFFFF;
+            cache = 0;
+            cacheSize = 1;
+        }
+
+        void shiftLow()
+        {
+            if((uint32_t)low < 0xFF000000u || (low >> 32) != 0)
+            {
+                uint8_t carry = (uint8_t)(low >> 32);
+                uint8_t pending = cache;
+                do
+                {
+                    out->push_back((uint8_t)(pending + carry));
+                    pending = 0xFF;
+                } while(--cacheSize != 0);
+                cache = (uint8_t)(low >> 24);
+            }
+            cacheSize++;
+            low = (low & 0x00FFFFFF) << 8;
+        }
+
+        void bit(uint16_t& prob, int b)
+        {
+            uint32_t bound = (range >> PROB_BITS) * prob;
+            if(!b)
+            {
+                range = bound;
+                prob += ((1 << PROB_BITS) - prob) >> ADAPT_SHIFT;
+            }
+            else
+            {
+                low += bound;
+                range -= bound;
+                prob -= prob >> ADAPT_SHIFT;
+            }
+            while(range < RANGE_TOP)
+            {
+                range <<= 8;
+                shiftLow();
+            }
+        }
+
+        // `count` low bits of `v` at probability 1/2, most significant first
+        void direct(uint32_t v, int count)
+        {
+            for(int i = count - 1; i >= 0; i--)
+            {
+                range >>= 1;
+                if(v >> i & 1)
+                    low += range;
+                while(range < RANGE_TOP)
+                {
+                    range <<= 8;
+                    shiftLow();
+                }
+            }
+        }
+
+        void finish()
+        {
+            for(int i = 0; i < 5; i++)
+                shiftLow();
+        }
+    };
+
+    // Reads past the end of the payload as zero bytes, so truncated input decodes to garbage
+    // values but never overruns
+    struct RangeDecoder
+    {
+        const uint8_t* p = nullptr;
+        const uint8_t* end = nullptr;
+        uint32_t range = 0xFFFFFFFF, code = 0;
+
+        uint8_t next() { return p < end ? *p++ : 0; }
+
+        void begin(const uint8_t* data, size_t size)
+        {
+            p = data;
+            end = data + size;
+            range = 0xFFFFFFFF;
+            code = 0;
+            for(int i = 0; i < 5; i++)
+                code = code << 8 | next();
+        }
+
+        int bit(uint16_t& prob)
+        {
+            uint32_t bound = (range >> PROB_BITS) * prob;
+            int b;
+            if(code < bound)
+            {
+                range = bound;
+                prob += ((1 << PROB_BITS) - prob) >> ADAPT_SHIFT;
+                b = 0;
+            }
+            else
+            {
+                code -= bound;
+                range -= bound;
+                prob -= prob >> ADAPT_SHIFT;
+                b = 1;
+            }
+            while(range < RANGE_TOP)
+            {
+                range <<= 8;
+                code = code << 8 | next();
+            }
+            return b;
+        }
+
+        uint32_t direct(int count)
+        {
+            uint32_t v = 0;
+            for(int i = 0; i < count; i++)
+            {
+                range >>= 1;
+                int b = code >= range;
+                if(b)
+                    code -= range;
+                v = v << 1 | b;
+                while(range < RANGE_TOP)
+                {
+                    range <<= 8;
+                    code = code << 8 | next();
+                }
+            }
+            return v;
+        }
+    };
+
+    // Adaptive model of one stream of signed residuals: a zero flag (two contexts chosen by the
+    // caller), the sign, the bit length of the magnitude in unary and the bit below the leading
+    // one. The remaining low bits are close to uniform and sent at probability 1/2.
+    struct IntModel
+    {
+        uint16_t zero[2], sign, length[32], top[32];
+
+        void reset()
+        {
+            zero[0] = zero[1] = sign = PROB_INIT;
+            std::fill(std::begin(length), std::end(length), PROB_INIT);
+            std::fill(std::begin(top), std::end(top), PROB_INIT);
+        }
+
+        void encode(RangeEncoder& rc, int32_t v, int ctx)
+        {
+            rc.bit(zero[ctx], v != 0);
+            if(!v)
+                return;
+            rc.bit(sign, v < 0);
+            uint32_t m = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+            int len = std::bit_width(m) - 1; // position of the leading one
+            for(int i = 0; i < len; i++)
+                rc.bit(length[i], 1);
+            if(len < 31)
+                rc.bit(length[len], 0);
+            if(len >= 1)
+                rc.bit(top[len], m >> (len - 1) & 1);
+            if(len >= 2)
+                rc.direct(m, len - 1);
+        }
+
+        int32_t decode(RangeDecoder& rc, int ctx)
+        {
+            if(!rc.bit(zero[ctx]))
+                return 0;
+            bool negative = rc.bit(sign);
+            int len = 0;
+            while(len < 31 && rc.bit(length[len]))
+                len++;
+            uint32_t m = 1;
+            if(len >= 1)
+                m = m << 1 | rc.bit(top[len]);
+            if(len >= 2)
+                m = m << (len - 1) | rc.direct(len - 1);
+            return (int32_t)(negative ? 0u - m : m);
+        }
+    };
+
+    // Every adaptive probability of the stream, restarted at each keyframe
+    struct Model
+    {
+        std::array<IntModel, TRACKS> key, delta;
+        uint16_t changed[16]; // delta frames, by Predictor::changeContext
+
+        void reset()
+        {
+            for(int t = 0; t < TRACKS; t++)
+            {
+                key[t].reset();
+                delta[t].reset();
+            }
+            std::fill(std::begin(changed), std::end(changed), PROB_INIT);
+        }
+    };
+
+    // Keyframe tracks are coded as differences to the previous body: ids that were created
+    // together usually lie next to each other and move alike. The angle is coded as is.
+    inline int32_t keyReference(const Tracks& previous, int t) { return t == 2 ? 0 : previous[t]; }
+
+    // `v` in quanta (`scale` is 1 / quantum). Non-finite values are recorded as 0, out of range
+    // ones are clamped.
+    inline float scaled(float v, float scale)
+    {
+        if(!std::isfinite(v))
+            return 0.0f;
+        return std::fmin(std::fmax(v * scale, -2.0e9f), 2.0e9f);
+    }
+
+    inline int32_t quantize(float v, float scale) { return (int32_t)std::lrint(scaled(v, scale)); }
+
+    // Residual of a motion track against its prediction, zero inside the dead-band
+    inline int32_t residual(float v, float scale, int32_t predicted)
+    {
+        float s = scaled(v, scale);
+        if(std::fabs((double)s - predicted) < DEAD_BAND)
+            return 0;
+        return (int32_t)((uint32_t)(int32_t)std::lrint(s) - (uint32_t)predicted);
+    }
+
+    // Angle wrapped to [-pi, pi), so the angle track stays small for spinning bodies
+    inline float wrapAngle(float a)
+    {
+        constexpr float pi = std::numbers::pi_v<float>;
+        if(a >= -pi && a < pi)
+            return a;
+        return a - 2.0f * pi * std::floor((a + pi) / (2.0f * pi));
+    }
+
+    // Predictor shared by the encoder and the decoder: the decoded tracks of the last two frames
+    // per body, which tracks had residuals in the last frame and how many frames ago any had.
+    // Velocity and angle continue linearly; position moves by the velocity already decoded for
+    // the frame, as in the engine's integration, so falling and sliding bodies cost nothing
+    // and bodies at rest (velocity below one quantum) are held in place.
+    struct Predictor
+    {
+        std::vector<Tracks> prev, prev2;
+        std::vector<uint8_t> mask;
+        std::vector<uint8_t> quiet; // frames since the body last had residuals, saturating
+        int64_t velToPos = 0; // position quanta per velocity quantum and frame, 16.16 fixed point
+
+        void setup(const Header& h)
+        {
+            velToPos = std::llround((double)h.velQuantum * h.dt / h.posQuantum * 65536.0);
+        }
+
+        // A keyframe drops the whole history, so bodies created later start from the same zero
+        // state in the encoder and in a decoder that seeked to the keyframe
+        void resize(int n, bool keyframe)
+        {
+            if(keyframe)
+            {
+                prev.clear();
+                prev2.clear();
+                mask.clear();
+                quiet.clear();
+            }
+            prev.resize(n, Tracks{});
+            prev2.resize(n, Tracks{});
+            mask.resize(n, 0);
+            quiet.resize(n, 0);
+        }
+
+        // Context of a delta frame's "has residuals" flag: how long the body has been quiet and
+        // whether the previous body had residuals
+        int changeContext(int id, bool lastChanged) const
+        {
+            return std::min(7, (int)std::bit_width(quiet[id])) * 2 + lastChanged;
+        }
+
+        // `current` holds the tracks of this frame that come earlier in ORDER
+        int32_t predict(int id, int t, const Tracks& current) const
+        {
+            if(t == ACTIVE)
+                return prev[id][t];
+            if(t < 2)
+                return (int32_t)((uint32_t)prev[id][t] + (uint32_t)(int32_t)((current[3 + t] * velToPos + 32768) >> 16));
+            return (int32_t)(2u * (uint32_t)prev[id][t] - (uint32_t)prev2[id][t]);
+        }
+
+        // After a keyframe both history frames are the keyframe, so the next prediction is "unchanged"
+        void push(int id, const Tracks& v, bool keyframe, uint8_t residuals)
+        {
+            prev2[id] = keyframe ? v : prev[id];
+            prev[id] = v;
+            mask[id] = residuals;
+            quiet[id] = keyframe || residuals ? 0 : (uint8_t)std::min(255, quiet[id] + 1);
+        }
+    };
+}
+
+// Writes a recording through a background thread. record() only copies the state into one of
+// QUEUE frame slots (blocking while all are pending); quantization, encoding and file I/O run on
+// the recorder thread.
+struct FrameRecorder
+{
+    struct RawFrame
+    {
+        int count = 0;
+        std::vector<Vec2> position, velocity;
+        std::vector<float> theta;
+        std::vector<int> active;
+    };
+
+    static constexpr int QUEUE = 4;
+
+    recording::Header header;
+    std::FILE* file = nullptr;
+    std::thread worker;
+    std::atomic<bool> failed{false}; // set by the recorder thread on a write error
+    size_t bytesWritten = 0; // file size so far, owned by the recorder thread
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::array<RawFrame, QUEUE> ring;
+    uint64_t pushed = 0, consumed = 0; // frames handed to / finished by the recorder thread
+    bool stopping = false;
+
+    // Encoder state, only touched by the recorder thread
+    recording::Predictor predictor;
+    recording::Model model;
+    recording::RangeEncoder rc;
+    std::vector<uint8_t> payload;
+
+    FrameRecorder() = default;
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+    ~FrameRecorder() { close(); }
+
+    // `dt` is the time between recorded frames in seconds. Quanta are in world units, radians
+    // and world units / s.
+    bool open(const char* path, float dt, int keyframeInterval = 300, float posQuantum = 1.0f / 32,
+              float angleQuantum = 1.0f / 512, float velQuantum = 1.0f)
+    {
+        close();
+        file = std::fopen(path, "wb");
+        if(!file)
+            return false;
+        header = {recording::MAGIC, recording::VERSION, posQuantum, angleQuantum, velQuantum, dt, std::max(1, keyframeInterval)};
+        if(std::fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            std::fclose(file);
+            file = nullptr;
+            return false;
+        }
+        bytesWritten = sizeof(header);
+        failed = false;
+        pushed = consumed = 0;
+        stopping = false;
+        predictor = {};
+        predictor.setup(header);
+        worker = std::thread([this]{ run(); });
+        return true;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    // Queues the current state of `world` as the next frame. Call between steps.
+    void record(const World& world)
+    {
+        if(!file)
+            return;
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&]{ return pushed - consumed < QUEUE; });
+        RawFrame& f = ring[pushed % QUEUE];
+        lock.unlock();
+
+        // The slot belongs to this thread until `pushed` is advanced
+        const BodyStorage& b = world.bodies;
+        int n = world.allocated;
+        f.count = n;
+        f.position.assign(b.position.begin(), b.position.begin() + n);
+        f.velocity.assign(b.velocity.begin(), b.velocity.begin() + n);
+        f.theta.assign(b.theta.begin(), b.theta.begin() + n);
+        f.active.assign(b.active.begin(), b.active.begin() + n);
+
+        lock.lock();
+        pushed++;
+        cv.notify_all();
+    }
+
+    // Flushes the pending frames and closes the file
+    void close()
+    {
+        if(!file)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+        std::fclose(file);
+        file = nullptr;
+    }
+
+private:
+    void run()
+    {
+        while(true)
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&]{ return consumed < pushed || stopping; });
+            if(consumed == pushed)
+                break;
+            const RawFrame& f = ring[consumed % QUEUE];
+            uint32_t frame = (uint32_t)consumed;
+            lock.unlock();
+
+            encode(f, frame);
+
+            lock.lock();
+            consumed++;
+            cv.notify_all();
+        }
+    }
+
+    void encode(const RawFrame& f, uint32_t frame)
+    {
+        using namespace recording;
+        bool keyframe = frame % header.keyframeInterval == 0;
+        predictor.resize(f.count, keyframe);
+        if(keyframe)
+            model.reset();
+        payload.clear();
+        rc.begin(payload);
+
+        const float scale[ACTIVE] = {
+            1.0f / header.posQuantum, 1.0f / header.posQuantum, 1.0f / header.angleQuantum,
+            1.0f / header.velQuantum, 1.0f / header.velQuantum,
+        };
+        Tracks previous{};
+        bool lastChanged = false;
+        for(int id = 0; id < f.count; id++)
+        {
+            float value[ACTIVE] = {
+                f.position[id].x, f.position[id].y, wrapAngle(f.theta[id]), f.velocity[id].x, f.velocity[id].y,
+            };
+            Tracks v{};
+            uint8_t mask = 0;
+            if(keyframe)
+            {
+                for(int t = 0; t < ACTIVE; t++)
+                    v[t] = quantize(value[t], scale[t]);
+                v[ACTIVE] = f.active[id];
+                for(int t : ORDER)
+                    model.key[t].encode(rc, (int32_t)((uint32_t)v[t] - (uint32_t)keyReference(previous, t)), 0);
+                previous = v;
+            }
+            else
+            {
+                Tracks r;
+                for(int t : ORDER)
+                {
+                    int32_t p = predictor.predict(id, t, v);
+                    r[t] = t == ACTIVE ? (int32_t)((uint32_t)f.active[id] - (uint32_t)p) : residual(value[t], scale[t], p);
+                    v[t] = (int32_t)((uint32_t)p + (uint32_t)r[t]);
+                    mask |= (r[t] != 0) << t;
+                }
+                rc.bit(model.changed[predictor.changeContext(id, lastChanged)], mask != 0);
+                if(mask)
+                    for(int t : ORDER)
+                        model.delta[t].encode(rc, r[t], predictor.mask[id] >> t & 1);
+                lastChanged = mask != 0;
+            }
+            predictor.push(id, v, keyframe, mask);
+        }
+        rc.finish();
+
+        size_t size = payload.size();
+        ChunkHeader ch = {(uint32_t)size, frame, f.count, keyframe};
+        if(std::fwrite(&ch, sizeof(ch), 1, file) != 1 ||
+           (size && std::fwrite(payload.data(), size, 1, file) != 1))
+            failed = true;
+        bytesWritten += sizeof(ch) + size;
+    }
+};
+
+// Reads a recording written by FrameRecorder. open() indexes the chunks, seek() decodes any
+// frame starting from the closest keyframe at or before it, next() advances by one frame.
+// The decoded state of the current frame is in the public arrays (quantized values).
+struct FrameReader
+{
+    std::vector<Vec2> position, velocity;
+    std::vector<float> theta;
+    std::vector<int> active;
+
+    recording::Header header;
+    std::FILE* file = nullptr;
+    struct Entry
+    {
+        long offset; // of the chunk header
+        int keyframe;
+    };
+    std::vector<Entry> index; // one entry per frame
+    int current = -1; // frame held in the arrays, -1 before the first decode
+
+    recording::Predictor predictor;
+    recording::Model model;
+    recording::RangeDecoder rc;
+    std::vector<uint8_t> payload;
+
+    FrameReader() = default;
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+    ~FrameReader() { close(); }
+
+    // Returns false if the file cannot be read or is not a recording. A truncated last chunk
+    // (e.g. from a crashed run) is ignored.
+    bool open(const char* path)
+    {
+        close();
+        file = std::fopen(path, "rb");
+        if(!file)
+            return false;
+        if(std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != recording::MAGIC ||
+           header.version != recording::VERSION)
+        {
+            close();
+            return false;
+        }
+        predictor.setup(header);
+        std::fseek(file, 0, SEEK_END);
+        long end = std::ftell(file);
+        long offset = sizeof(header);
+        recording::ChunkHeader ch;
+        while(offset + (long)sizeof(ch) <= end)
+        {
+            std::fseek(file, offset, SEEK_SET);
+            if(std::fread(&ch, sizeof(ch), 1, file) != 1 || ch.frame != index.size())
+                break;
+            long next = offset + (long)sizeof(ch) + (long)ch.size;
+            if(next > end)
+                break;
+            index.push_back({offset, ch.keyframe});
+            offset = next;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if(file)
+            std::fclose(file);
+        file = nullptr;
+        index.clear();
+        current = -1;
+    }
+
+    int frameCount() const { return (int)index.size(); }
+
+    bool seek(int frame)
+    {
+        if(frame < 0 || frame >= frameCount())
+            return false;
+        if(frame == current)
+            return true;
+        int start = frame;
+        if(current < 0 || frame <= current || frame - current > header.keyframeInterval)
+            while(!index[start].keyframe)
+                start--;
+        else
+            start = current + 1;
+        for(int f = start; f <= frame; f++)
+        {
+            if(!decode(f))
+            {
+                current = -1; // the decoder state is partial, the next seek restarts at a keyframe
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool next() { return seek(current + 1); }
+
+private:
+    bool decode(int frame)
+    {
+        using namespace recording;
+        ChunkHeader ch;
+        std::fseek(file, index[frame].offset, SEEK_SET);
+        if(std::fread(&ch, sizeof(ch), 1, file) != 1)
+            return false;
+        payload.resize(ch.size);
+        if(ch.size && std::fread(payload.data(), ch.size, 1, file) != 1)
+            return false;
+
+        int n = ch.bodyCount;
+        predictor.resize(n, ch.keyframe);
+        position.resize(n);
+        velocity.resize(n);
+        theta.resize(n);
+        active.resize(n);
+        if(ch.keyframe)
+            model.reset();
+        rc.begin(payload.data(), payload.size());
+
+        Tracks previous{};
+        bool lastChanged = false;
+        for(int id = 0; id < n; id++)
+        {
+            Tracks v{};
+            uint8_t mask = 0;
+            if(ch.keyframe)
+            {
+                for(int t : ORDER)
+                    v[t] = (int32_t)((uint32_t)keyReference(previous, t) + (uint32_t)model.key[t].decode(rc, 0));
+                previous = v;
+            }
+            else
+            {
+                bool changed = rc.bit(model.changed[predictor.changeContext(id, lastChanged)]);
+                for(int t : ORDER)
+                {
+                    v[t] = predictor.predict(id, t, v);
+                    if(changed)
+                    {
+                        int32_t r = model.delta[t].decode(rc, predictor.mask[id] >> t & 1);
+                        v[t] = (int32_t)((uint32_t)v[t] + (uint32_t)r);
+                        mask |= (r != 0) << t;
+                    }
+                }
+                lastChanged = mask != 0;
+            }
+            predictor.push(id, v, ch.keyframe, mask);
+            position[id] = Vec2(v[0] * header.posQuantum, v[1] * header.posQuantum);
+            theta[id] = v[2] * header.angleQuantum;
+            velocity[id] = Vec2(v[3] * header.velQuantum, v[4] * header.velQuantum);
+            active[id] = v[5];
+        }
+        current = frame;
+        return true;
+    }
+};
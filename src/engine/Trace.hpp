@@ -0,0 +1,175 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Timeline tracing: scoped zones timed with the TSC, kept in a fixed ring buffer per thread and
+// written out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// While tracing is off a zone costs one relaxed atomic load. Each thread only ever writes its own
+// buffer, so recording takes no lock; start() and writeChromeTrace() read and reset every buffer
+// and must only be called while no other thread is recording (between Engine steps).
+// Zone names are stored by pointer and must be string literals.
+namespace tracing
+{
+    constexpr int CAPACITY = 1 << 17; // events kept per thread, the oldest are overwritten
+
+    struct Event
+    {
+        const char* name;
+        uint64_t begin, end; // ticks
+    };
+
+    struct Buffer
+    {
+        std::string thread;
+        std::vector<Event> events; // CAPACITY events, allocated by start() or on registration while tracing
+        uint64_t count = 0; // events written since start(), including overwritten ones
+
+        void push(const char* name, uint64_t begin, uint64_t end)
+        {
+            events[count & (CAPACITY - 1)] = {name, begin, end};
+            count++;
+        }
+    };
+
+    struct State
+    {
+        std::atomic<bool> enabled{false};
+        std::mutex m; // guards `buffers`
+        std::vector<std::unique_ptr<Buffer>> buffers; // index = tid in the trace, never freed
+        uint64_t startTicks = 0;
+        std::chrono::steady_clock::time_point startTime;
+    };
+
+    inline State& state()
+    {
+        static State s;
+        return s;
+    }
+
+    inline uint64_t now()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    inline bool enabled() { return state().enabled.load(std::memory_order_relaxed); }
+
+    // The calling thread's buffer, registered on first use. Its events are allocated here only if
+    // tracing is already on; threads should register before (e.g. with setThreadName when they
+    // start), so that recording never allocates.
+    inline Buffer& buffer()
+    {
+        thread_local Buffer* local = nullptr;
+        if(!local)
+        {
+            State& s = state();
+            std::lock_guard<std::mutex> lock(s.m);
+            s.buffers.push_back(std::make_unique<Buffer>());
+            local = s.buffers.back().get();
+            local->thread = "thread " + std::to_string(s.buffers.size() - 1);
+            if(enabled())
+                local->events.resize(CAPACITY);
+        }
+        return *local;
+    }
+
+    inline void setThreadName(const std::string& name) { buffer().thread = name; }
+
+    // Records a span measured with now() on the calling thread
+    inline void emit(const char* name, uint64_t begin, uint64_t end)
+    {
+        if(enabled())
+            buffer().push(name, begin, end);
+    }
+
+    // Drops every recorded event and starts recording. Allocates the buffers of the threads
+    // registered so far on the first call.
+    inline void start()
+    {
+        State& s = state();
+        {
+            std::lock_guard<std::mutex> lock(s.m);
+            for(auto& b : s.buffers)
+            {
+                if(b->events.empty())
+                    b->events.resize(CAPACITY);
+                b->count = 0;
+            }
+            s.startTime = std::chrono::steady_clock::now();
+            s.startTicks = now();
+            // Under the lock, so a thread registering concurrently either is allocated above or sees tracing on
+            s.enabled.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    inline void stop() { state().enabled.store(false, std::memory_order_relaxed); }
+
+    // Times the enclosing scope
+    struct Zone
+    {
+        const char* name;
+        uint64_t begin;
+
+        explicit Zone(const char* name) : name(name), begin(enabled() ? now() : 0) {}
+        ~Zone()
+        {
+            if(begin)
+                emit(name, begin, now());
+        }
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+    };
+
+    // Writes the events recorded since start() as complete ("X") events, one trace thread per
+    // buffer, with timestamps in microseconds since start(). Ticks are converted with the rate
+    // measured between start() and this call. Returns false if the file can't be written.
+    inline bool writeChromeTrace(const char* path)
+    {
+        State& s = state();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - s.startTime).count();
+        uint64_t ticks = now() - s.startTicks;
+        double usPerTick = ticks > 0 && us > 0 ? us / (double)ticks : 0.0;
+
+        FILE* file = std::fopen(path, "w");
+        if(!file)
+            return false;
+        std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        std::lock_guard<std::mutex> lock(s.m);
+        for(size_t tid = 0; tid < s.buffers.size(); tid++)
+        {
+            const Buffer& b = *s.buffers[tid];
+            std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                         first ? "" : ",\n", tid, b.thread.c_str());
+            first = false;
+            uint64_t begin = b.count > (uint64_t)CAPACITY ? b.count - CAPACITY : 0;
+            for(uint64_t k = begin; k < b.count; k++)
+            {
+                const Event& e = b.events[k & (CAPACITY - 1)];
+                if(e.begin < s.startTicks)
+                    continue;
+                std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                             e.name, tid, (e.begin - s.startTicks) * usPerTick, (e.end - e.begin) * usPerTick);
+            }
+        }
+        std::fprintf(file, "\n]}\n");
+        bool ok = !std::ferror(file);
+        return std::fclose(file) == 0 && ok;
+    }
+}
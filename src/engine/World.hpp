@@ -1,26 +1,119 @@
 #pragma once
 #include <vector>
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <cmath>
+#include <cstring>
 #include "math/Vec2.hpp"
 #include "structures/AABB.hpp"
 #include "Mesh.hpp"
 #include "Body.hpp"
 #include "structures/Quad.hpp"
+#include "structures/AABBTree.hpp"
+#include "structures/SweepAndPrune.hpp"
 
-//Lightweight container for Bodies, collision pairs, and the QuadGrid broadphase.
+// Broadphase structure used to find candidate pairs.
+// Grid: sparse multi-level QuadGrid, cheap for many similarly sized bodies.
+// Tree: dynamic AABB tree, better suited to mixed sizes and clustered or very sparse scenes.
+// SweepAndPrune: incrementally sorted endpoints with a persistent pair list, cheap for settling piles.
+enum class Broadphase { Grid, Tree, SweepAndPrune };
+
+// How Engine parallelizes the resolve phase.
+// Coloring: batches of contacts that share no dynamic body, one batch after another.
+// Islands: connected groups of touching dynamic bodies, each solved serially as one task.
+enum class ResolveMode { Coloring, Islands };
+
+//Lightweight container for Bodies, collision pairs, and the broadphase (QuadGrid, AABBTree or SweepAndPrune).
 struct World 
 {
-    int allocated, activeCount;
-    int colCnt;
+    int allocated = 0, activeCount = 0, sleepingCount = 0;
+    int colCnt = 0;
+
+    // Sleeping: an island that has at least one contact and whose bodies all stayed below both
+    // velocity thresholds for timeToSleep seconds is put to sleep (active = 3). Bodies touching
+    // nothing never sleep, so a body slowing down at the top of a throw keeps flying. Sleeping
+    // bodies are not integrated, transformed or moved in the broadphase, and only pair with awake
+    // bodies. They wake when an awake body touches them, on applyForce / wakeBody, or when a body
+    // under them is deleted.
+    bool sleepEnabled = true;
+    float sleepLinear = 5.0f; // world units / s
+    float sleepAngular = 0.5f; // rad / s
+    float timeToSleep = 0.5f; // s
+    std::vector<float> islandSleep; // per island root: smallest sleepTime of its bodies
 
     std::vector<int> freeList;
-    std::vector<Body> bodies;
+    BodyStorage bodies;
 
     std::vector<std::pair<int, int>> collisionPairs;
     std::vector<CollisionResult> collisionData;
 
+    // Iterative sequential-impulse solver: every step runs velocityIterations passes over the
+    // colliding contacts with accumulated, clamped impulses, then positionIterations passes of
+    // position correction. More iterations trade time for stiffer stacks.
+    int velocityIterations = 4;
+    int positionIterations = 2;
+    float corrFactor = 0.2f; // fraction of the remaining penetration removed per position pass
+    float slop = 0.05f; // penetration left uncorrected so resting contacts stay in contact
+    float restitutionThreshold = 20.0f; // world units / s; slower approaches do not bounce
+    std::vector<ContactConstraint> constraints; // solver state per collision pair, valid if colliding
+
+    // Warm starting: the accumulated impulses of last step's colliding pairs, sorted by pair key,
+    // seed the solver for contact points whose feature ids still match. Lets a few iterations
+    // hold piles that would need many more from a cold start.
+    bool warmStarting = true;
+    std::vector<CachedManifold> manifolds;
+    std::vector<CachedManifold> nextManifolds;
+    // Bodies deleted since the last storeManifolds: their entries in `manifolds` are skipped, and
+    // dropped when storeManifolds rebuilds the cache from the current contacts
+    std::vector<uint8_t> staleManifolds; // per body id
+    std::vector<int> staleIds;
+
+    // Contact graph coloring for the parallel resolve: within one color no two contacts share
+    // a dynamic body. Contacts of bodies that already use every color go to color MAX_COLORS,
+    // which is solved serially.
+    static constexpr int MAX_COLORS = 64;
+    int numColors = 0;
+    std::vector<uint64_t> colorMask; // colors used by each body's contacts this step
+    std::vector<int> contactColor; // color of each collision pair, -1 if not colliding
+    std::vector<int> colorOrder; // colliding pair indices grouped by color
+    std::vector<int> colorStart; // color c owns colorOrder[colorStart[c], colorStart[c+1])
+
+    // Contact islands: connected components of dynamic bodies linked by colliding pairs.
+    // Static bodies do not link islands, so a pile resting on the ground is its own island.
+    ResolveMode resolveMode = ResolveMode::Coloring;
+    int numIslands = 0;
+    std::vector<int> islandParent; // union-find forest over body ids
+    std::vector<int> islandIndex; // compact island index of each root, -1 if not assigned
+    std::vector<int> contactIsland; // island of each collision pair, -1 if not colliding
+    std::vector<int> islandOrder; // colliding pair indices grouped by island, in pair order
+    std::vector<int> islandStart; // island k owns islandOrder[islandStart[k], islandStart[k+1])
+
+    // Deterministic mode: Engine puts the collision pairs in canonical (min id, max id) order every
+    // step, so trajectories depend only on the bodies, not on the broadphase structure or its
+    // history (e.g. after switching broadphase or restoring a snapshot). Results never depend on
+    // the number of worker threads.
+    bool deterministic = false;
+
+    Broadphase broadphase = Broadphase::Grid;
     QuadGrid quad;
+    std::vector<int> awakePerLevel; // awake bodies per grid level, including quad.overflowLevel
+    // Static bodies get their own tree: their (often large) leaves would otherwise inflate the
+    // internal nodes that every dynamic query walks through.
+    AABBTree dynamicTree, staticTree;
+    SweepAndPrune sap;
+
+    // Per-pair buffers are reserved for PAIRS_PER_BODY pairs per body slot (settled piles stay
+    // below 3) and per-body ones for every slot, again whenever `allocated` outgrows the last
+    // reservation. Contact counts keep climbing while a scene settles; with the room taken up
+    // front those steps do not allocate.
+    static constexpr int PAIRS_PER_BODY = 4;
+    int reservedBodies = 0;
 
+    // w, h: extent of the main play area. It only sizes the coarsest grid cells;
+    // bodies may move anywhere outside of it.
     World(int w, int h) : quad(std::max(w, h)) {}
 
     // Add new dynamic body, reuses id from freeList if available, otherwise appends to `bodies`.
@@ -30,7 +123,7 @@ struct World
         if(!freeList.empty()) 
         {
             id = freeList.back();
-            bodies[id] = Body(pos, vel, meshID, 1.0f / mass, 1.0f / MoI, scale, ang, res);
+            bodies.set(id, pos, vel, meshID, 1.0f / mass, 1.0f / MoI, scale, ang, res);
             freeList.pop_back();
         } 
         else 
@@ -38,6 +131,7 @@ struct World
             id = allocated++;
             bodies.emplace_back(pos, vel, meshID, 1.0f / mass, 1.0f / MoI, scale, ang, res);
         }
+        placeBody(id);
         return id;
     }
 
@@ -48,7 +142,7 @@ struct World
         if(!freeList.empty()) 
         {
             id = freeList.back();
-            bodies[id] = Body(pos, Vec2(0, 0), meshID, 0.0f, 0.0f, scale, ang, res, 2);
+            bodies.set(id, pos, Vec2(0, 0), meshID, 0.0f, 0.0f, scale, ang, res, 2);
             freeList.pop_back();
         } 
         else 
@@ -56,167 +150,864 @@ struct World
             id = allocated++;
             bodies.emplace_back(pos, Vec2(0, 0), meshID, 0.0f, 0.0f, scale, ang, res, 2);
         }
+        placeBody(id);
         return id;
     }
 
-    // Marks body inactive and pushes its id to freeList.
-    // Does NOT immediately remove the id from quad.grid — grid init / reset handles that.
+    // Gives a newly added body its vertex pool slice and fills it, so it can be queried
+    // (contains, rendering) and paired before it is first moved.
+    void placeBody(int id)
+    {
+        bodies.allocVertices(id);
+        bodies[id].calculateAABB();
+    }
+
+    // Marks body inactive, removes it from the broadphase and pushes its id to freeList.
+    // Sleeping bodies touching it are woken, since they may have been resting on it; they are
+    // found through the broadphase, so deleting many bodies does not scan every body per delete.
     void deleteBody(int id)
     {
-        if(bodies[id].active == 0)
+        if(bodies.active[id] == 0)
             return;
-        bodies[id].active = 0;
+        const AABB& aabb = bodies.aabb[id];
+        auto wake = [&](int id2) {
+            if(bodies.active[id2] == 3 && aabb.overlaps(bodies.aabb[id2]))
+                wakeBody(id2);
+        };
+        if(broadphase == Broadphase::SweepAndPrune && bodies.info[id].ind >= 0)
+        {
+            // The pairs removed with the body are exactly its overlaps
+            sap.remove(id, wake);
+            bodies.info[id].ind = -1;
+        }
+        else
+        {
+            forEachCandidate(id, wake);
+            removeFromBroadphase(id);
+        }
+        bodies.active[id] = 0;
         freeList.push_back(id);
+        // The id is reused by the next added body, which must not inherit these impulses
+        if((int)staleManifolds.size() < allocated)
+            staleManifolds.resize(allocated);
+        if(!staleManifolds[id])
+        {
+            staleManifolds[id] = 1;
+            staleIds.push_back(id);
+        }
+    }
+
+    // True if the cached manifold belongs to a body deleted since the last storeManifolds
+    bool isStale(const CachedManifold& m) const
+    {
+        if(staleIds.empty())
+            return false;
+        size_t id1 = m.key >> 32, id2 = (uint32_t)m.key;
+        return (id1 < staleManifolds.size() && staleManifolds[id1]) || (id2 < staleManifolds.size() && staleManifolds[id2]);
+    }
+
+    // Calls f(id2) for the bodies the broadphase holds near body `id`: a superset of the sleeping
+    // bodies whose AABB overlaps its AABB (static bodies and `id` itself may show up too).
+    // Tree: the dynamic tree, as static bodies never sleep. Grid: the cells of every level that can
+    // hold an overlapping body, or all bodies when that range has more cells than there are bodies.
+    // SweepAndPrune, or a body not in the broadphase yet: all bodies.
+    template<class F>
+    void forEachCandidate(int id, F&& f)
+    {
+        const AABB& aabb = bodies.aabb[id];
+        if(bodies.info[id].ind < 0 || broadphase == Broadphase::SweepAndPrune)
+        {
+            for(int id2 = 0; id2 < allocated; id2++)
+                f(id2);
+        }
+        else if(broadphase == Broadphase::Tree)
+        {
+            dynamicTree.query(aabb, f);
+        }
+        else
+        {
+            // A body sits in the cell of its AABB's min corner and is at most one cell wide, so
+            // overlapping bodies of level i lie in the cells from one before min to max
+            auto range = [&](int i, int& x0, int& y0, int& x1, int& y1) {
+                quad.gridCoord(x0, y0, i, aabb.min.x, aabb.min.y);
+                quad.gridCoord(x1, y1, i, aabb.max.x, aabb.max.y);
+                x0--;
+                y0--;
+            };
+            long long cellCount = 0;
+            for(int i = 0; i < quad.numLevels; i++)
+            {
+                int x0, y0, x1, y1;
+                range(i, x0, y0, x1, y1);
+                if(quad.occ[i])
+                    cellCount += (long long)(x1 - x0 + 1) * (y1 - y0 + 1);
+            }
+            if(cellCount > allocated)
+            {
+                for(int id2 = 0; id2 < allocated; id2++)
+                    f(id2);
+                return;
+            }
+            if(quad.occ[quad.overflowLevel])
+                for(int id2: quad.cell(quad.getIndex(quad.overflowLevel, 0, 0)))
+                    f(id2);
+            for(int i = 0; i < quad.numLevels; i++)
+            {
+                if(!quad.occ[i])
+                    continue;
+                int x0, y0, x1, y1;
+                range(i, x0, y0, x1, y1);
+                for(int x = x0; x <= x1; x++)
+                    for(int y = y0; y <= y1; y++)
+                    {
+                        int ind = quad.getIndex(i, x, y);
+                        if(ind != -1)
+                            for(int id2: quad.cell(ind))
+                                f(id2);
+                    }
+            }
+        }
+    }
+
+    void wakeBody(int id)
+    {
+        if(bodies.active[id] != 3)
+            return;
+        bodies.active[id] = 1;
+        bodies.sleepTime[id] = 0;
+    }
+
+    // Switches the broadphase structure. Bodies are taken out of the old one here
+    // and inserted into the new one by the next updateBroadphase().
+    void setBroadphase(Broadphase mode)
+    {
+        if(mode == broadphase)
+            return;
+        for(int id = 0; id < allocated; id++)
+            if(bodies.active[id])
+                removeFromBroadphase(id);
+        broadphase = mode;
+        reserveBroadphase();
+    }
+
+    // Snapshot blob: SnapshotHeader, then the body arrays listed in snapshotArrays (`allocated`
+    // entries each), freeList and the warm starting manifolds. Raw POD data in native byte order,
+    // meant for rollback and checkpoints on the same build. Settings are not part of the state.
+    static constexpr uint32_t SNAPSHOT_MAGIC = 0x534D534F; // "OSMS"
+    static constexpr uint32_t SNAPSHOT_VERSION = 2; // 2: BodyInfo carries the shape type
+    struct SnapshotHeader
+    {
+        uint32_t magic, version;
+        int allocated, freeCount, manifoldCount;
+        int meshCount; // size of meshdata::meshes when taken; restore needs at least as many meshes
+    };
+
+    // Calls f on every body array stored in a snapshot, in blob order. Skipped: correction (zero
+    // between steps) and the vertex / normal pools, which are refilled from the meshes.
+    template<class Storage, class F>
+    static void snapshotArrays(Storage& b, F&& f)
+    {
+        f(b.position); f(b.velocity); f(b.acceleration);
+        f(b.theta); f(b.omega); f(b.cosTheta); f(b.sinTheta);
+        f(b.invMass); f(b.invMoI); f(b.aabb); f(b.active); f(b.sleepTime); f(b.info);
+    }
+
+    size_t snapshotSize(const SnapshotHeader& h) const
+    {
+        size_t bytes = sizeof(SnapshotHeader);
+        snapshotArrays(bodies, [&](const auto& v) { bytes += h.allocated * sizeof(v[0]); });
+        return bytes + h.freeCount * sizeof(int) + h.manifoldCount * sizeof(CachedManifold);
+    }
+
+    // Checks the blob fields that restore() would use as indices: body states, mesh ids (with the
+    // cached shape type and vertex count), freeList entries and manifold keys. `data` is a blob of
+    // snapshotSize(h) bytes; it may be unaligned, so fields are copied out.
+    bool snapshotIndicesValid(const SnapshotHeader& h, const uint8_t* data) const
+    {
+        size_t offset = sizeof(h), activeAt = 0, infoAt = 0;
+        snapshotArrays(bodies, [&](const auto& v) {
+            if((const void*)&v == (const void*)&bodies.active)
+                activeAt = offset;
+            if((const void*)&v == (const void*)&bodies.info)
+                infoAt = offset;
+            offset += h.allocated * sizeof(v[0]);
+        });
+
+        std::vector<uint8_t> state(h.allocated); // active, or 4 once listed in freeList
+        for(int id = 0; id < h.allocated; id++)
+        {
+            int act;
+            std::memcpy(&act, data + activeAt + id * sizeof(int), sizeof(int));
+            if(act < 0 || act > 3)
+                return false;
+            state[id] = (uint8_t)act;
+            if(!act)
+                continue;
+            BodyInfo info;
+            std::memcpy(&info, data + infoAt + id * sizeof(BodyInfo), sizeof(BodyInfo));
+            if(info.meshID < 0 || info.meshID >= (int)meshdata::meshes.size())
+                return false;
+            const Mesh& mesh = meshdata::meshes[info.meshID];
+            if(info.shape != mesh.type || info.vertCount != (int)mesh.points.size())
+                return false;
+        }
+
+        for(int i = 0; i < h.freeCount; i++, offset += sizeof(int))
+        {
+            int id;
+            std::memcpy(&id, data + offset, sizeof(int));
+            if(id < 0 || id >= h.allocated || state[id] != 0)
+                return false;
+            state[id] = 4;
+        }
+
+        // Manifolds are looked up with a binary search, so keys must also be strictly increasing
+        uint64_t prev = 0;
+        for(int i = 0; i < h.manifoldCount; i++, offset += sizeof(CachedManifold))
+        {
+            CachedManifold m;
+            std::memcpy(&m, data + offset, sizeof(m));
+            uint64_t id1 = m.key >> 32, id2 = (uint32_t)m.key;
+            if(id1 >= (uint64_t)h.allocated || id2 >= (uint64_t)h.allocated || m.count < 0 || m.count > 2 ||
+               (i > 0 && m.key <= prev))
+                return false;
+            prev = m.key;
+        }
+        return true;
+    }
+
+    // Writes the simulation state into `out`. Take it between steps; reusing `out` avoids allocations.
+    void snapshot(std::vector<uint8_t>& out) const
+    {
+        int manifoldCount = (int)std::count_if(manifolds.begin(), manifolds.end(),
+            [this](const CachedManifold& m) { return !isStale(m); });
+        SnapshotHeader h = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, allocated, (int)freeList.size(),
+            manifoldCount, (int)meshdata::meshes.size()};
+        out.resize(snapshotSize(h));
+        uint8_t* p = out.data();
+        auto put = [&p](const void* src, size_t bytes) {
+            if(bytes)
+                std::memcpy(p, src, bytes);
+            p += bytes;
+        };
+        put(&h, sizeof(h));
+        snapshotArrays(bodies, [&](const auto& v) { put(v.data(), allocated * sizeof(v[0])); });
+        put(freeList.data(), freeList.size() * sizeof(int));
+        for(const CachedManifold& m: manifolds)
+            if(!isStale(m))
+                put(&m, sizeof(m));
+    }
+
+    // Replaces the simulation state with a blob written by snapshot(). Returns false, leaving the
+    // world untouched, if the header or size is wrong, the blob references meshes that are not
+    // registered, or a body state, freeList entry or manifold key is out of range.
+    // The broadphase is rebuilt lazily: every body is reinserted by the next updateBroadphase(),
+    // which also refills the vertex pools. Bit-identical re-simulation after a restore needs
+    // `deterministic`, since the rebuilt broadphase reports pairs in a different order.
+    bool restore(const uint8_t* data, size_t size)
+    {
+        SnapshotHeader h;
+        if(size < sizeof(h))
+            return false;
+        std::memcpy(&h, data, sizeof(h));
+        if(h.magic != SNAPSHOT_MAGIC || h.version != SNAPSHOT_VERSION || h.allocated < 0 || h.freeCount < 0 ||
+           h.manifoldCount < 0 || h.meshCount > (int)meshdata::meshes.size() || size != snapshotSize(h) ||
+           !snapshotIndicesValid(h, data))
+            return false;
+
+        const uint8_t* p = data + sizeof(h);
+        auto get = [&p](void* dst, size_t bytes) {
+            if(bytes)
+                std::memcpy(dst, p, bytes);
+            p += bytes;
+        };
+        allocated = h.allocated;
+        bodies.resize(allocated);
+        snapshotArrays(bodies, [&](auto& v) { get(v.data(), allocated * sizeof(v[0])); });
+        std::fill(bodies.correction.begin(), bodies.correction.end(), Vec2(0, 0));
+        freeList.resize(h.freeCount);
+        get(freeList.data(), h.freeCount * sizeof(int));
+        manifolds.resize(h.manifoldCount);
+        get(manifolds.data(), h.manifoldCount * sizeof(CachedManifold));
+        for(int id: staleIds)
+            staleManifolds[id] = 0;
+        staleIds.clear();
+
+        quad = QuadGrid(quad.length, quad.limit);
+        dynamicTree = AABBTree(dynamicTree.margin);
+        staticTree = AABBTree(staticTree.margin);
+        sap = SweepAndPrune();
+        collisionPairs.clear();
+        collisionData.clear();
+        colCnt = 0;
+
+        bodies.vertexUsed = bodies.normalUsed = 0;
+        activeCount = sleepingCount = 0;
+        for(int id = 0; id < allocated; id++)
+        {
+            BodyInfo& info = bodies.info[id];
+            info.ind = info.level = info.slot = -1;
+            info.vertCap = 0;
+            if(!bodies.active[id])
+                continue;
+            bodies.allocVertices(id);
+            activeCount++;
+            sleepingCount += bodies.active[id] == 3;
+        }
+        return true;
+    }
+
+    // Tree holding body `id` in Tree mode
+    AABBTree& treeOf(int id)
+    {
+        return bodies.active[id] == 2 ? staticTree : dynamicTree;
+    }
+
+    // info.ind is the grid cell in Grid mode, the tree proxy in Tree mode and the body id
+    // in SweepAndPrune mode (-1 when not inserted).
+    void removeFromBroadphase(int id)
+    {
+        BodyInfo& info = bodies.info[id];
+        if(info.ind < 0)
+            return;
+        if(broadphase == Broadphase::SweepAndPrune)
+        {
+            sap.remove(id);
+            info.ind = -1;
+            return;
+        }
+        if(broadphase == Broadphase::Tree)
+        {
+            treeOf(id).remove(info.ind);
+            info.ind = -1;
+            return;
+        }
+        // Swap-remove from the grid cell, fixing up the slot of the id that moved into its place.
+        int moved = quad.remove(info.level, info.ind, info.slot);
+        if(moved != -1)
+            bodies.info[moved].slot = info.slot;
+        info.ind = -1;
     }
 
-    // Recomputes body AABB and chooses quad level based on AABB size.
-    // Computes grid coordinates and flattened index using QuadGrid helpers.
+    // Recomputes body AABB and updates its place in the broadphase.
+    // Tree: the leaf is only reinserted when the AABB left its fat AABB.
+    // SweepAndPrune: new bodies get endpoints; sorting happens once for all bodies in updateBroadphase.
+    // Grid: chooses quad level based on AABB size, computes grid coordinates and the cell
+    // using QuadGrid helpers, and only touches quad.grid when the level or cell changed.
     void updateIndex(int id)
     {
-        Body& body = bodies[id];
+        Body body = bodies[id];
         body.calculateAABB();
-        const AABB& aabb = body.aabb;    
+        const AABB& aabb = body.aabb();    
+        BodyInfo& info = bodies.info[id];
+
+        if(broadphase == Broadphase::SweepAndPrune)
+        {
+            if(info.ind < 0)
+            {
+                sap.insert(id);
+                info.ind = id;
+            }
+            return;
+        }
+        if(broadphase == Broadphase::Tree)
+        {
+            if(info.ind < 0)
+                info.ind = treeOf(id).insert(id, aabb);
+            else
+                treeOf(id).move(info.ind, aabb);
+            return;
+        }
+
         float len = std::max(aabb.max.x - aabb.min.x, aabb.max.y - aabb.min.y);
-        body.level = quad.getLevel(len);
+        int level = quad.getLevel(len);
         
         int gx, gy;
-        quad.gridCoord(gx, gy, body.level, aabb.min.x, aabb.min.y);
-        body.ind = quad.getIndex(body.level, gx, gy);
+        quad.gridCoord(gx, gy, level, aabb.min.x, aabb.min.y);
+
+        if(quad.isCell(info.ind, level, gx, gy))
+            return;
 
-        if(body.ind == -1)
-            deleteBody(id);
+        removeFromBroadphase(id);
+        info.level = level;
+        info.slot = quad.insert(level, gx, gy, id, info.ind);
     }
 
-    // Rebuilds the quad.grid from scratch by iterating all active bodies
-    void initGrid()
+    // Brings the broadphase up to date with the current body positions. Grid cells and tree
+    // leaves persist between steps, so only bodies that changed cell / left their fat AABB are moved.
+    // In SweepAndPrune mode this also re-sorts the endpoints, leaving the pairs in sap.pairs.
+    // Only awake bodies (and bodies not yet in the broadphase) are re-transformed into their pool
+    // slices; static and sleeping bodies keep their vertices, AABB and broadphase entry.
+    void updateBroadphase()
     {
         activeCount = 0;
+        sleepingCount = 0;
+        if(broadphase == Broadphase::Grid)
+            awakePerLevel.assign(quad.overflowLevel + 1, 0);
+        const int* active = bodies.active.data();
         for(int id = 0; id < allocated; id++) 
         {
-            if(bodies[id].active)
-            {
+            if(!active[id])
+                continue;
+            activeCount++;
+            sleepingCount += active[id] == 3;
+            if(active[id] == 1 || bodies.info[id].ind < 0)
                 updateIndex(id);
-                if(bodies[id].ind >= 0)
-                {
-                    quad.occ[bodies[id].level] = 1;
-                    quad.grid[bodies[id].ind].push_back(id);
-                    activeCount++;
-                }
-            }
+            if(broadphase == Broadphase::Grid && active[id] == 1)
+                awakePerLevel[bodies.info[id].level]++;
         }
+        if(broadphase == Broadphase::SweepAndPrune)
+            sap.update(bodies.aabb.data(), bodies.active.data());
     }
 
-    // Clears per-cell occupant lists referenced by active bodies; resets occupancy flags.
-    void resetGrid()
+    // Produces potential collision pairs for `id` into `local`; every pair is emitted once and
+    // involves at least one awake body. Pairs of static / sleeping bodies are never needed.
+    // Not used in SweepAndPrune mode, where sap.pairs already holds every pair.
+    void getNeighbors(int id, std::vector<std::pair<int, int>>& local)
     {
-        for(int id = 0; id < allocated; id++) 
+        if(broadphase == Broadphase::Tree)
+            getTreeNeighbors(id, local);
+        else if(broadphase == Broadphase::Grid)
+            getGridNeighbors(id, local);
+    }
+
+    // Queries both trees with the body's tight AABB. Only awake bodies query, so static and sleeping
+    // partners are always emitted and awake pairs only for id < id2.
+    // Leaves are fat, so the tight AABBs are checked again before adding to `local`.
+    void getTreeNeighbors(int id, std::vector<std::pair<int, int>>& local)
+    {
+        if(bodies.active[id] != 1)
+            return;
+        const AABB* aabbs = bodies.aabb.data();
+        const AABB& aabb = aabbs[id];
+        staticTree.query(aabb, [&](int id2) {
+            if(aabb.overlaps(aabbs[id2]))
+                local.emplace_back(id, id2);
+        });
+        const int* active = bodies.active.data();
+        dynamicTree.query(aabb, [&](int id2) {
+            if((id < id2 || active[id2] != 1) && id != id2 && aabb.overlaps(aabbs[id2]))
+                local.emplace_back(id, id2);
+        });
+    }
+
+    // Scans 3x3 neighborhoods from the body's level up to the coarsest level (level 0),
+    // then the overflow cell.
+    // Awake bodies find every partner on their own and coarser levels; on the same level they
+    // emit awake partners only for id < id2 (simple dedup avoidance).
+    // Static and sleeping bodies only look for awake partners on coarser levels (which cannot
+    // find them), and skip the scan entirely when no coarser level holds an awake body.
+    // Bodies in the overflow cell only pair among themselves; everyone else finds them.
+    // Final fast check: AABB overlap before adding to `local`.
+    void getGridNeighbors(int id, std::vector<std::pair<int, int>>& local)
+    {
+        const int* active = bodies.active.data();
+        const AABB* aabbs = bodies.aabb.data();
+        const AABB& aabb = aabbs[id];
+        int level = bodies.info[id].level;
+        const int ov = quad.overflowLevel;
+        const bool awake = active[id] == 1;
+
+        if(!awake)
         {
-            if(bodies[id].active) 
+            if(level == ov)
+                return;
+            bool any = awakePerLevel[ov] > 0;
+            for(int i = 0; i < level && !any; i++)
+                any = awakePerLevel[i] > 0;
+            if(!any)
+                return;
+        }
+        // Levels that may hold partners this body has to emit itself
+        const int* counts = awake ? quad.occ.data() : awakePerLevel.data();
+
+        auto scanCell = [&](int ind, bool sameLevel) {
+            for(int id2: quad.cell(ind))
             {
-                int ind = bodies[id].ind;
-                if(!quad.grid[ind].empty())
-                    quad.grid[ind].clear();
-                //Might be worth clearing the memory here as well
+                bool awake2 = active[id2] == 1;
+                if(!awake && !awake2)
+                    continue;
+                if(sameLevel && awake2 && id >= id2)
+                    continue;
+                if(aabb.overlaps(aabbs[id2]))
+                    local.emplace_back(id, id2);
             }
+        };
+
+        if(counts[ov])
+        {
+            int ind = quad.getIndex(ov, 0, 0);
+            scanCell(ind, level == ov);
         }
-        for(int& i: quad.occ)
-            i = 0;
-    }
+        if(level == ov)
+            return;
 
-    // Produces potential collision pairs for `id` by scanning 3x3 neighborhoods
-    // from the body's level up to the coarsest level (level 0).
-    // Performs simple dedup avoidance (when scanning the same level, emit only id < id2).
-    // Final fast check: AABB overlap before adding to `local`.
-    void getNeighbors(int id, std::vector<std::pair<int, int>>& local)
-    {
-        const Body& body = bodies[id];
-        int mX = body.aabb.min.x;
-        int mY = body.aabb.min.y;
-        for(int i = body.level; i >= 0; i--)
+        for(int i = awake ? level : level - 1; i >= 0; i--)
         {
-            if(!quad.occ[i])
+            if(!counts[i])
                 continue;
             int gx, gy;
-            quad.gridCoord(gx, gy, i, mX, mY);
+            quad.gridCoord(gx, gy, i, aabb.min.x, aabb.min.y);
             for(int x = gx-1; x <= gx+1; x++)
             {
                 for(int y = gy-1; y <= gy+1; y++)
                 {
                     int ind = quad.getIndex(i, x, y);
                     if(ind != -1)
-                    {
-                        for(int id2: quad.grid[ind])
-                        {
-                            if(bodies[id].active == 2 && bodies[id2].active == 2)   
-                                continue;
-                            if(i == body.level && id >= id2)
-                                continue;
-                            if(body.aabb.overlaps(bodies[id2].aabb))
-                                local.emplace_back(id, id2);
-                        }
-                    }
+                        scanCell(ind, i == level);
                 }
             }
         }
     }
 
-    void resetForces(const Vec2& g)
+    // Range versions of the per-body passes touch only the bodies in [begin, end),
+    // so the Engine runs them as parallel tasks
+    void resetForces(const Vec2& g, int begin, int end)
     {
-        for(int id = 0; id < allocated; id++) 
-            bodies[id].acceleration = g;
+        Vec2* acc = bodies.acceleration.data();
+        for(int id = begin; id < end; id++) 
+            acc[id] = g;
     }
 
-    void applyCorrections()
+    void applyCorrections(int begin, int end)
     {
-        for(int id = 0; id < allocated; id++) 
+        const int* active = bodies.active.data();
+        Vec2* pos = bodies.position.data();
+        Vec2* corr = bodies.correction.data();
+        for(int id = begin; id < end; id++) 
         {
-            if(bodies[id].active == 1)
+            if(active[id] == 1)
             {
-                bodies[id].position += bodies[id].correction;
-                bodies[id].correction = Vec2(0, 0);
+                pos[id] += corr[id];
+                corr[id] = Vec2(0, 0);
             }
         }
     }
 
     void applyForce(int id, const Vec2& force)
     {
-        bodies[id].acceleration += force * bodies[id].invMass;
+        wakeBody(id);
+        bodies.acceleration[id] += force * bodies.invMass[id];
     }
 
-    void updateVelocities(float dt)
+    // Semi-implicit Euler: velocity from the acceleration, then position and angle from the new velocity
+    void integrate(float dt, int begin, int end)
     {
-        for(int id = 0; id < allocated; id++) 
+        const int* active = bodies.active.data();
+        const Vec2* acc = bodies.acceleration.data();
+        const float* omega = bodies.omega.data();
+        Vec2* vel = bodies.velocity.data();
+        Vec2* pos = bodies.position.data();
+        float* theta = bodies.theta.data();
+        float* ct = bodies.cosTheta.data();
+        float* st = bodies.sinTheta.data();
+        for(int id = begin; id < end; id++) 
         {
-            if(bodies[id].active == 1)
-                bodies[id].velocity += bodies[id].acceleration * dt;
+            if(active[id] == 1)
+            {
+                vel[id] += acc[id] * dt;
+                pos[id] += vel[id] * dt;
+                theta[id] += omega[id] * dt;
+                ct[id] = std::cos(theta[id]);
+                st[id] = std::sin(theta[id]);
+            }
         }
     }
 
-    void updatePositions(float dt)
+    // Returns true if the buffers were grown, with room for reservedBodies * PAIRS_PER_BODY pairs
+    bool reserveBuffers()
     {
-        for(int id = 0; id < allocated; id++) 
+        if(allocated <= reservedBodies)
+            return false;
+        reservedBodies = std::max(allocated, 2 * reservedBodies);
+        size_t pairs = (size_t)reservedBodies * PAIRS_PER_BODY;
+        collisionPairs.reserve(pairs);
+        collisionData.reserve(pairs);
+        constraints.reserve(pairs);
+        manifolds.reserve(pairs);
+        nextManifolds.reserve(pairs);
+        contactColor.reserve(pairs);
+        colorOrder.reserve(pairs);
+        contactIsland.reserve(pairs);
+        islandOrder.reserve(pairs);
+        colorMask.reserve(reservedBodies);
+        islandParent.reserve(reservedBodies);
+        islandIndex.reserve(reservedBodies);
+        islandStart.reserve(reservedBodies + 1);
+        islandSleep.reserve(reservedBodies);
+        reserveBroadphase();
+        return true;
+    }
+
+    // The tree only allocates when it outgrows its node pool, which it does during the warmup
+    void reserveBroadphase()
+    {
+        if(broadphase == Broadphase::Grid)
+            quad.reserve(reservedBodies);
+        else if(broadphase == Broadphase::SweepAndPrune)
+            sap.reserve(reservedBodies * PAIRS_PER_BODY);
+    }
+
+    // Greedy coloring of the colliding pairs in pair order: each contact takes the lowest color
+    // not yet used by either of its dynamic bodies. Static bodies never conflict.
+    // Fills colorOrder / colorStart (counting sort by color), numColors and colCnt.
+    void colorContacts()
+    {
+        int n = (int)collisionData.size();
+        const int* active = bodies.active.data();
+        colorMask.assign(allocated, 0);
+        contactColor.resize(n);
+        colorStart.assign(MAX_COLORS + 2, 0);
+        colCnt = 0;
+        numColors = 0;
+
+        for(int i = 0; i < n; i++)
         {
-            if(bodies[id].active == 1)
+            if(!collisionData[i].collide)
+            {
+                contactColor[i] = -1;
+                continue;
+            }
+            colCnt++;
+            auto [id1, id2] = collisionPairs[i];
+            uint64_t used = colorMask[id1] | colorMask[id2];
+            int c = ~used ? std::countr_zero(~used) : MAX_COLORS;
+            if(c < MAX_COLORS)
             {
-                bodies[id].position += bodies[id].velocity * dt;
-                bodies[id].theta += bodies[id].omega * dt;
-                bodies[id].cosTheta = std::cos(bodies[id].theta);
-                bodies[id].sinTheta = std::sin(bodies[id].theta);
+                if(active[id1] == 1)
+                    colorMask[id1] |= 1ULL << c;
+                if(active[id2] == 1)
+                    colorMask[id2] |= 1ULL << c;
+                numColors = std::max(numColors, c + 1);
             }
+            contactColor[i] = c;
+            colorStart[c + 1]++;
+        }
+
+        for(int c = 0; c <= MAX_COLORS; c++)
+            colorStart[c + 1] += colorStart[c];
+        colorOrder.resize(colCnt);
+        std::array<int, MAX_COLORS + 1> cursor;
+        std::copy(colorStart.begin(), colorStart.end() - 1, cursor.begin());
+        for(int i = 0; i < n; i++)
+            if(contactColor[i] >= 0)
+                colorOrder[cursor[contactColor[i]]++] = i;
+    }
+
+    int findIsland(int id)
+    {
+        while(islandParent[id] != id)
+        {
+            islandParent[id] = islandParent[islandParent[id]];
+            id = islandParent[id];
         }
+        return id;
     }
 
-    // Walks collisionData / collisionPairs and calls Body::resolve for actual impulse resolution.
-    void resolveCollisions()
+    // Unions the dynamic bodies of every colliding pair (the smaller root becomes the parent),
+    // numbers islands in order of their first contact, and groups the contacts by island.
+    // Fills islandOrder / islandStart, numIslands and colCnt.
+    void buildIslands()
     {
+        int n = (int)collisionData.size();
+        const int* active = bodies.active.data();
+        islandParent.resize(allocated);
+        for(int id = 0; id < allocated; id++)
+            islandParent[id] = id;
         colCnt = 0;
-        for (int i = 0; i < collisionData.size(); ++i)
+
+        for(int i = 0; i < n; i++)
         {
-            auto [id1, id2] = collisionPairs[i];
-            if (!collisionData[i].collide)
+            if(!collisionData[i].collide)
                 continue;
             colCnt++;
-            Body::resolve(bodies[id1], bodies[id2], collisionData[i]);
+            auto [id1, id2] = collisionPairs[i];
+            if(active[id1] != 1 || active[id2] != 1)
+                continue;
+            int r1 = findIsland(id1), r2 = findIsland(id2);
+            if(r1 != r2)
+                islandParent[std::max(r1, r2)] = std::min(r1, r2);
+        }
+
+        islandIndex.assign(allocated, -1);
+        contactIsland.resize(n);
+        // Every island has a dynamic root body, so allocated + 1 starts always suffice
+        islandStart.assign(allocated + 1, 0);
+        numIslands = 0;
+        for(int i = 0; i < n; i++)
+        {
+            if(!collisionData[i].collide)
+            {
+                contactIsland[i] = -1;
+                continue;
+            }
+            auto [id1, id2] = collisionPairs[i];
+            int root = findIsland(active[id1] == 1 ? id1 : id2);
+            if(islandIndex[root] < 0)
+                islandIndex[root] = numIslands++;
+            contactIsland[i] = islandIndex[root];
+            islandStart[contactIsland[i] + 1]++;
+        }
+
+        for(int k = 0; k < numIslands; k++)
+            islandStart[k + 1] += islandStart[k];
+        islandOrder.resize(colCnt);
+        for(int i = 0; i < n; i++)
+            if(contactIsland[i] >= 0)
+                islandOrder[islandStart[contactIsland[i]]++] = i;
+        // The scatter advanced every start to the next island's start; shift back
+        for(int k = numIslands; k > 0; k--)
+            islandStart[k] = islandStart[k - 1];
+        islandStart[0] = 0;
+    }
+
+    static uint64_t pairKey(int id1, int id2)
+    {
+        return (uint64_t)(uint32_t)id1 << 32 | (uint32_t)id2;
+    }
+
+    // Solver steps for collision pair i; the caller guarantees it is colliding
+    void prepareContact(int i)
+    {
+        auto [id1, id2] = collisionPairs[i];
+        const CachedManifold* cached = nullptr;
+        if(warmStarting)
+        {
+            uint64_t key = pairKey(id1, id2);
+            auto it = std::lower_bound(manifolds.begin(), manifolds.end(), key,
+                [](const CachedManifold& m, uint64_t k) { return m.key < k; });
+            if(it != manifolds.end() && it->key == key && !isStale(*it))
+                cached = &*it;
+        }
+        Body::prepareContact(bodies[id1], bodies[id2], collisionData[i], constraints[i], restitutionThreshold, cached);
+    }
+
+    void warmStart(int i)
+    {
+        auto [id1, id2] = collisionPairs[i];
+        Body::warmStart(bodies[id1], bodies[id2], constraints[i]);
+    }
+
+    void solveVelocity(int i)
+    {
+        auto [id1, id2] = collisionPairs[i];
+        Body::solveVelocity(bodies[id1], bodies[id2], constraints[i]);
+    }
+
+    void solvePosition(int i)
+    {
+        auto [id1, id2] = collisionPairs[i];
+        Body::solvePosition(bodies[id1], bodies[id2], constraints[i], corrFactor, slop);
+    }
+
+    // Replaces the warm starting cache with this step's accumulated impulses, which also drops
+    // the entries of deleted bodies
+    void storeManifolds()
+    {
+        nextManifolds.clear();
+        for(int i = 0; i < (int)collisionData.size(); i++)
+        {
+            if(!collisionData[i].collide)
+                continue;
+            const ContactConstraint& cc = constraints[i];
+            CachedManifold m;
+            m.key = pairKey(collisionPairs[i].first, collisionPairs[i].second);
+            m.count = cc.count;
+            for(int k = 0; k < cc.count; k++)
+            {
+                m.id[k] = cc.points[k].id;
+                m.normalImpulse[k] = cc.points[k].normalImpulse;
+                m.tangentImpulse[k] = cc.points[k].tangentImpulse;
+            }
+            nextManifolds.push_back(m);
+        }
+        std::sort(nextManifolds.begin(), nextManifolds.end(),
+            [](const CachedManifold& a, const CachedManifold& b) { return a.key < b.key; });
+        manifolds.swap(nextManifolds);
+        for(int id: staleIds)
+            staleManifolds[id] = 0;
+        staleIds.clear();
+    }
+
+    // Wakes sleeping bodies that an awake body collides with. Runs between narrowphase and
+    // resolve, so the woken body takes part in this step's resolve as a dynamic body. Its
+    // contacts with other sleeping bodies are found next step, so wake-ups spread one hop per step.
+    void wakeContacts()
+    {
+        if(!sleepingCount)
+            return;
+        for(int i = 0; i < (int)collisionData.size(); i++)
+        {
+            if(!collisionData[i].collide)
+                continue;
+            auto [id1, id2] = collisionPairs[i];
+            if(bodies.active[id2] == 1)
+                wakeBody(id1);
+            else if(bodies.active[id1] == 1)
+                wakeBody(id2);
+        }
+    }
+
+    // Advances every awake body's sleepTime (reset when its solver velocity or angular velocity
+    // exceeds the thresholds) and puts islands to sleep that have a contact and whose
+    // slowest-to-settle body has rested for timeToSleep. The position correction is not tested:
+    // it never dies out in a deep pile, which keeps pushing its lower layers apart by a fraction
+    // of the slop every step. The linear threshold is about a quarter body width per second;
+    // residual solver jitter in tall stacks stays below it. Bodies falling asleep drop their
+    // pending correction along with their velocity.
+    // Needs this step's islands (buildIslands).
+    void updateSleep(float dt)
+    {
+        int* active = bodies.active.data();
+        if(!sleepEnabled)
+        {
+            for(int id = 0; sleepingCount && id < allocated; id++)
+                wakeBody(id);
+            return;
+        }
+
+        Vec2* vel = bodies.velocity.data();
+        Vec2* corr = bodies.correction.data();
+        float* omega = bodies.omega.data();
+        float* sleepTime = bodies.sleepTime.data();
+        const float lin2 = sleepLinear * sleepLinear;
+        islandSleep.resize(allocated);
+        for(int id = 0; id < allocated; id++)
+        {
+            if(active[id] != 1)
+                continue;
+            Vec2 v = vel[id];
+            if(Vec2::dot(v, v) > lin2 || std::abs(omega[id]) > sleepAngular)
+                sleepTime[id] = 0;
+            else
+                sleepTime[id] += dt;
+            islandSleep[id] = 0.0f;
+        }
+        // Only islands with a contact may sleep: their roots start from infinity, the others stay at 0
+        for(int i = 0; i < (int)collisionData.size(); i++)
+        {
+            if(!collisionData[i].collide)
+                continue;
+            auto [id1, id2] = collisionPairs[i];
+            int id = active[id1] == 1 ? id1 : id2;
+            if(active[id] == 1)
+                islandSleep[findIsland(id)] = std::numeric_limits<float>::infinity();
+        }
+        for(int id = 0; id < allocated; id++)
+        {
+            if(active[id] != 1)
+                continue;
+            float& s = islandSleep[findIsland(id)];
+            s = std::min(s, sleepTime[id]);
+        }
+        for(int id = 0; id < allocated; id++)
+        {
+            if(active[id] != 1 || islandSleep[findIsland(id)] < timeToSleep)
+                continue;
+            active[id] = 3;
+            vel[id] = Vec2(0, 0);
+            corr[id] = Vec2(0, 0);
+            omega[id] = 0;
         }
     }
 };
\ No newline at end of file
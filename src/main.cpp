@@ -14,7 +14,9 @@ const int WIDTH = 1200;
 const int HEIGHT = 800;
 const float DT = 0.016f; 
 const float PI = 3.14159265f;
+const int CIRCLE_MESH = 7; // registered after the primitives (0..4) and the walls (5, 6)
 World world(WIDTH, HEIGHT);
+std::vector<uint8_t> checkpoint; // World::snapshot blob for the Save / Load buttons
 
 struct Settings
 {
@@ -22,6 +24,8 @@ struct Settings
     bool showBoundingBoxes = false;
     bool showGrid = false;
     bool showCollisions = false;
+    int broadphase = 0;
+    int resolveMode = 0;
     int currentMesh = 0;
     float scale = 1.0f;
     float restitution = 0.7f;
@@ -41,18 +45,18 @@ void setupProjection() {
 
 void renderGridLines() 
 {
+    if(world.broadphase != Broadphase::Grid)
+        return;
     std::set<std::array<int, 4>> rects;
     for(int id = 0; id < world.allocated; id++)
     {
-        if(world.bodies[id].active != 1)
+        if((world.bodies.active[id] != 1 && world.bodies.active[id] != 3) || world.bodies.info[id].ind < 0)
+            continue;
+        int lvl, x, y;
+        world.quad.cellCoord(world.bodies.info[id].ind, lvl, x, y);
+        if(lvl == world.quad.overflowLevel)
             continue;
-        int lvl = world.bodies[id].level;
         int sz = world.quad.length >> lvl;
-        int cnt = 1 << lvl;
-        
-        int offset = world.bodies[id].ind - world.quad.levels[lvl];
-        int x = offset % cnt;
-        int y = offset / cnt;
 
         rects.insert({lvl, sz, x, y});
     }
@@ -70,11 +74,11 @@ void renderBoundingBoxes() {
     glBegin(GL_LINES);
     glColor3f(0.0f, 1.0f, 0.0f);  
 
-    for (const Body& body: world.bodies) {
-        if(body.active == 0)
+    for (int id = 0; id < world.allocated; id++) {
+        if(world.bodies.active[id] == 0)
             continue;
 
-        const AABB& aabb = body.aabb;
+        const AABB& aabb = world.bodies.aabb[id];
 
         glVertex2f(aabb.min.x, aabb.min.y);
         glVertex2f(aabb.max.x, aabb.min.y);
@@ -93,17 +97,17 @@ void renderBoundingBoxes() {
 }
 
 void renderMesh(const Body& body, float mx, float my) {
-    const int meshID = body.meshID;
-
-    if(body.active == 2)
+    if(body.active() == 2)
         glColor3f(0.5f, 0.0f, 1.0f);
+    else if(body.active() == 3)
+        glColor3f(0.0f, 0.0f, 0.5f);
     else if(body.contains(Vec2(mx, my)))
         glColor3f(0.0f, 0.5f, 1.0f);
     else
         glColor3f(0.0f, 0.0f, 1.0f);
 
-    if (meshID == 1000) { 
-        const float radius = meshdata::RADIUS * body.scale; 
+    if (body.shape() == ShapeType::Circle) { 
+        const float radius = body.radius(); 
         const int segments = 32;
 
         // Draw circle
@@ -111,25 +115,25 @@ void renderMesh(const Body& body, float mx, float my) {
 
         for (int i = 0; i < segments; ++i) {
             float angle = 2.0f * PI * static_cast<float>(i) / segments;
-            float x = body.position.x + radius * std::cos(angle);
-            float y = body.position.y + radius * std::sin(angle);
+            float x = body.position().x + radius * std::cos(angle);
+            float y = body.position().y + radius * std::sin(angle);
             glVertex2f(x, y);
         }
         glEnd();
 
-        Vec2 dir = Vec2(body.cosTheta, body.sinTheta) * radius;
-        Vec2 end = body.position + dir;
+        Vec2 dir = Vec2(body.cosTheta(), body.sinTheta()) * radius;
+        Vec2 end = body.position() + dir;
 
         glBegin(GL_LINES);
-        glVertex2f(body.position.x, body.position.y);
+        glVertex2f(body.position().x, body.position().y);
         glVertex2f(end.x, end.y);
         glEnd();
 
         return;
     }
 
-    const std::vector<Vec2>& transformed = body.transformed;
-    int n = transformed.size();
+    const Vec2* transformed = body.transformed();
+    int n = body.vertexCount();
 
     // Draw polygon edges
     glBegin(GL_LINES);
@@ -193,6 +197,7 @@ float uTime = 0.0f, cTime = 0.0f, rTime = 0.0f;
 float uAvg = 0.0f, cAvg = 0.0f, rAvg = 0.0f;
 int frame = 0;
 const int sample = 60;
+int traceFrames = 0; // steps left in the current trace capture
 
 
 
@@ -203,12 +208,7 @@ int main() {
         return -1;
     }
 
-    meshdata::addMesh({
-        Vec2(-10, -10),
-        Vec2(10, -10),
-        Vec2(10, 10),
-        Vec2(-10, 10),
-    });
+    meshdata::addBox(Vec2(10, 10));
 
     meshdata::addMesh({
         Vec2(0, -10),
@@ -239,23 +239,14 @@ int main() {
         Vec2(-20, 10),
     });
 
-    meshdata::addMesh({
-        Vec2(-(WIDTH - 100)/2, -20),
-        Vec2((WIDTH - 100)/2, -20),
-        Vec2((WIDTH - 100)/2, 20),
-        Vec2(-(WIDTH - 100)/2, 20),
-    });
-    meshdata::addMesh({
-        Vec2(-20, -(HEIGHT - 100)/2),
-        Vec2(20, -(HEIGHT - 100)/2),
-        Vec2(20, (HEIGHT - 100)/2),
-        Vec2(-20, (HEIGHT - 100)/2),
-    });
+    meshdata::addBox(Vec2((WIDTH - 100)/2, 20));
+    meshdata::addBox(Vec2(20, (HEIGHT - 100)/2));
+    meshdata::addCircle(10.0f);
 
     world.addBody(Vec2(WIDTH/2, HEIGHT - 105), 5, 1.0f, 0.0f, 0.2f);
     world.addBody(Vec2(105, HEIGHT/2), 6, 1.0f, 0.0f, 0.2f);
     world.addBody(Vec2(WIDTH-105, HEIGHT/2), 6, 1.0f, 0.0f, 0.2f);
-    world.addBody(Vec2(WIDTH/2, HEIGHT/2), 1000, 10.0f, 0.0f, 0.2f);
+    world.addBody(Vec2(WIDTH/2, HEIGHT/2), CIRCLE_MESH, 10.0f, 0.0f, 0.2f);
     world.addBody(Vec2(260, 640), 3, 5.0f, 0.0f, 0.2f);
 
     // OpenGL version and profile settings
@@ -309,19 +300,24 @@ int main() {
             if(ImGui::IsMouseDown(ImGuiMouseButton_Right)) {
                 for(int i = 0; i < world.allocated; i++)
                 {
-                    if(world.bodies[i].active != 1)
+                    if(world.bodies.active[i] != 1 && world.bodies.active[i] != 3)
                         continue;
                     if(world.bodies[i].contains(Vec2(mouseX, mouseY)))
                         world.deleteBody(i);
                 }
             }
         }
-        world.resetForces(Vec2(0.0, 20.0));
+        engine.resetForces(Vec2(0.0, 20.0));
         float tu, tc, tr;
         engine.updateStep(DT, tu, tc, tr);
         uTime += tu;
         cTime += tc;
         rTime += tr;
+        if (traceFrames > 0 && --traceFrames == 0)
+        {
+            tracing::stop();
+            tracing::writeChromeTrace("osmium_trace.json");
+        }
 
         ++frame;
         if (frame > sample) {
@@ -343,11 +339,11 @@ int main() {
             renderGridLines();
         if(settings.showMeshes)
         {
-            for(const Body& b: world.bodies)
+            for(int id = 0; id < world.allocated; id++)
             {
-                if(b.active == 0)
+                if(world.bodies.active[id] == 0)
                     continue;
-                renderMesh(b, mouseX, mouseY);
+                renderMesh(world.bodies[id], mouseX, mouseY);
             }
         }
         if(settings.showBoundingBoxes)
@@ -363,8 +359,28 @@ int main() {
         ImGui::Begin("Debug Window");
         ImGui::Text("Active Objects: %zu", world.activeCount);
         ImGui::Text("Allocated Objects: %zu", world.allocated);
+        ImGui::Text("Sleeping Objects: %d", world.sleepingCount);
         ImGui::Text("Intersection Pairs: %zu", world.collisionPairs.size());
         ImGui::Text("Collision Pairs: %zu", world.colCnt);
+        ImGui::RadioButton("Grid", &settings.broadphase, 0);
+        ImGui::SameLine();
+        ImGui::RadioButton("AABB Tree", &settings.broadphase, 1);
+        ImGui::SameLine();
+        ImGui::RadioButton("Sweep and Prune", &settings.broadphase, 2);
+        world.setBroadphase((Broadphase)settings.broadphase);
+        ImGui::RadioButton("Coloring", &settings.resolveMode, 0);
+        ImGui::SameLine();
+        ImGui::RadioButton("Islands", &settings.resolveMode, 1);
+        world.resolveMode = (ResolveMode)settings.resolveMode;
+        ImGui::SliderInt("Velocity Iterations", &world.velocityIterations, 1, 30);
+        ImGui::SliderInt("Position Iterations", &world.positionIterations, 0, 10);
+        ImGui::Checkbox("Warm Starting", &world.warmStarting);
+        ImGui::Checkbox("Deterministic", &world.deterministic);
+        if(ImGui::Button("Save Snapshot"))
+            world.snapshot(checkpoint);
+        ImGui::SameLine();
+        if(ImGui::Button("Load Snapshot") && !checkpoint.empty())
+            world.restore(checkpoint.data(), checkpoint.size());
         ImGui::End();
 
         ImGui::Begin("Render Options");
@@ -372,6 +388,7 @@ int main() {
         ImGui::Checkbox("Show Bounding Boxes", &settings.showBoundingBoxes);
         ImGui::Checkbox("Show Grid", &settings.showGrid);
         ImGui::Checkbox("Show Collisions", &settings.showCollisions);
+        ImGui::Checkbox("Allow Sleeping", &world.sleepEnabled);
         ImGui::End();
 
         ImGui::Begin("Shape Selection");
@@ -380,7 +397,7 @@ int main() {
         ImGui::RadioButton("Rock", &settings.currentMesh, 2);
         ImGui::RadioButton("Ramp", &settings.currentMesh, 3);
         ImGui::RadioButton("Trapezoid", &settings.currentMesh, 4);
-        ImGui::RadioButton("Circle", &settings.currentMesh, 1000);
+        ImGui::RadioButton("Circle", &settings.currentMesh, CIRCLE_MESH);
         ImGui::SliderFloat("Scale", &settings.scale, 0.25f, 4.0f);
         ImGui::SliderFloat("Restitution", &settings.restitution, 0.0f, 1.0f);
 
@@ -393,6 +410,14 @@ int main() {
         ImGui::Text("Collision: %.2f µs", cAvg);
         ImGui::Text("Resolve: %.2f µs", rAvg);
         ImGui::Text("Total: %.2f µs", uAvg + cAvg + rAvg);
+        if (traceFrames > 0)
+            ImGui::Text("Tracing... %d steps left", traceFrames);
+        else if (ImGui::Button("Capture Trace"))
+        {
+            // The next `sample` steps go to osmium_trace.json
+            tracing::start();
+            traceFrames = sample;
+        }
 
         ImGui::End();
 
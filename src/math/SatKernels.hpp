@@ -0,0 +1,108 @@
+#pragma once
+#include <limits>
+#include <algorithm>
+#include "math/Vec2.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// SIMD kernels for the separating axis test.
+// Axes are stored as separate x / y float arrays padded to a multiple of SAT_LANES;
+// padding lanes repeat axis 0, so they never change the minimum or the separation test.
+// The instruction set is chosen at compile time (AVX, SSE2, scalar fallback).
+namespace sat
+{
+    inline constexpr int SAT_LANES = 8;
+
+    inline int paddedCount(int n)
+    {
+        return (n + SAT_LANES - 1) / SAT_LANES * SAT_LANES;
+    }
+
+    // For every axis k in [0, nAxes):
+    //   overlap[k] = max_j dot(axis_k, a_j) - min_j dot(axis_k, b_j)
+    // Each block of axes is projected against all vertices at once (vertices are broadcast,
+    // axes sit in SIMD lanes), so no per-axis horizontal reduction is needed.
+    // Returns the index of the smallest overlap (first one on ties) and stores it in `minOverlap`,
+    // or returns -1 as soon as some axis separates the shapes (overlap <= 0).
+    inline int faceOverlaps(const float* ax, const float* ay, int nAxes,
+                            const Vec2* a, int na, const Vec2* b, int nb, float& minOverlap)
+    {
+        minOverlap = std::numeric_limits<float>::infinity();
+        int best = -1;
+        alignas(32) float ov[SAT_LANES];
+
+        for(int base = 0; base < nAxes; base += SAT_LANES)
+        {
+#if defined(__AVX__)
+            __m256 x = _mm256_loadu_ps(ax + base);
+            __m256 y = _mm256_loadu_ps(ay + base);
+            __m256 mx = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+            __m256 mn = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+            for(int j = 0; j < na; j++)
+            {
+                __m256 d = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(a[j].x)), _mm256_mul_ps(y, _mm256_set1_ps(a[j].y)));
+                mx = _mm256_max_ps(mx, d);
+            }
+            for(int j = 0; j < nb; j++)
+            {
+                __m256 d = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(b[j].x)), _mm256_mul_ps(y, _mm256_set1_ps(b[j].y)));
+                mn = _mm256_min_ps(mn, d);
+            }
+            __m256 o = _mm256_sub_ps(mx, mn);
+            if(_mm256_movemask_ps(_mm256_cmp_ps(o, _mm256_setzero_ps(), _CMP_LE_OQ)))
+                return -1;
+            _mm256_store_ps(ov, o);
+#elif defined(__SSE2__) || defined(_M_X64)
+            for(int h = 0; h < SAT_LANES; h += 4)
+            {
+                __m128 x = _mm_loadu_ps(ax + base + h);
+                __m128 y = _mm_loadu_ps(ay + base + h);
+                __m128 mx = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+                __m128 mn = _mm_set1_ps(std::numeric_limits<float>::infinity());
+                for(int j = 0; j < na; j++)
+                {
+                    __m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(a[j].x)), _mm_mul_ps(y, _mm_set1_ps(a[j].y)));
+                    mx = _mm_max_ps(mx, d);
+                }
+                for(int j = 0; j < nb; j++)
+                {
+                    __m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(b[j].x)), _mm_mul_ps(y, _mm_set1_ps(b[j].y)));
+                    mn = _mm_min_ps(mn, d);
+                }
+                __m128 o = _mm_sub_ps(mx, mn);
+                if(_mm_movemask_ps(_mm_cmple_ps(o, _mm_setzero_ps())))
+                    return -1;
+                _mm_store_ps(ov + h, o);
+            }
+#else
+            for(int l = 0; l < SAT_LANES; l++)
+            {
+                Vec2 axis(ax[base + l], ay[base + l]);
+                float mx = -std::numeric_limits<float>::infinity();
+                float mn = std::numeric_limits<float>::infinity();
+                for(int j = 0; j < na; j++)
+                    mx = std::max(mx, Vec2::dot(axis, a[j]));
+                for(int j = 0; j < nb; j++)
+                    mn = std::min(mn, Vec2::dot(axis, b[j]));
+                ov[l] = mx - mn;
+                if(ov[l] <= 0)
+                    return -1;
+            }
+#endif
+            int lanes = std::min(SAT_LANES, nAxes - base);
+            for(int l = 0; l < lanes; l++)
+            {
+                if(ov[l] < minOverlap)
+                {
+                    minOverlap = ov[l];
+                    best = base + l;
+                }
+            }
+        }
+        return best;
+    }
+}
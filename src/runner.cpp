@@ -0,0 +1,353 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <new>
+#include "engine/Engine.hpp"
+#include "engine/Recorder.hpp"
+#include "engine/Trace.hpp"
+
+// Headless simulation runner.
+// Builds one of the built-in scenes, steps Engine::updateStep at full speed
+// (no window, no vsync) and prints per-phase timings.
+
+const float DT = 0.016f;
+
+#ifdef OSMIUM_ALLOC_CHECK
+// Allocation checking build (-DOSMIUM_ALLOC_CHECK=ON): heap allocations made by the stepping
+// threads (the main thread and the Engine workers) are counted, and the run fails if a measured
+// step allocates. The recorder thread encodes the previous frames concurrently and is not counted.
+// Retained buffers are sized from the body count and only grow to the scene's high-water marks,
+// so the default warmup should leave every measured step at zero.
+std::atomic<long> allocations{0};
+std::atomic<std::thread::id> uncountedThread{};
+
+void* operator new(std::size_t size)
+{
+    if(std::this_thread::get_id() != uncountedThread.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+struct Options
+{
+    std::string scene = "mixed";
+    std::string broadphase = "grid";
+    std::string resolve = "coloring";
+    bool sleep = true;
+    bool warmStarting = true;
+    bool deterministic = false;
+    std::string record; // recording file, empty for none
+    std::string trace; // Chrome trace file, empty for none
+    int velocityIterations = 4;
+    int positionIterations = 2;
+    int bodies = 2000;
+    int steps = 600;
+    int warmup = 60;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned seed = 1;
+};
+
+struct Stats
+{
+    double sum = 0.0;
+    float mn = std::numeric_limits<float>::infinity();
+    float mx = 0.0f;
+
+    void add(float t)
+    {
+        sum += t;
+        mn = std::min(mn, t);
+        mx = std::max(mx, t);
+    }
+};
+
+void usage(const char* name)
+{
+    std::printf(
+        "usage: %s [options]\n"
+        "  --scene <mixed|circles|stack>  scene to simulate (default mixed)\n"
+        "  --broadphase <grid|tree|sap>   broadphase structure (default grid)\n"
+        "  --resolve <coloring|islands>   parallel resolve strategy (default coloring)\n"
+        "  --sleep <on|off>               let resting bodies fall asleep (default on)\n"
+        "  --vel-iters <n>                solver velocity iterations (default 4)\n"
+        "  --pos-iters <n>                solver position iterations (default 2)\n"
+        "  --warm <on|off>                warm start the solver from last step (default on)\n"
+        "  --deterministic <on|off>       canonical collision pair order (default off)\n"
+        "  --record <file>                record every measured step to <file>\n"
+        "  --trace <file>                 write a Chrome trace of the measured steps to <file>\n"
+        "  --bodies <n>                   number of dynamic bodies (default 2000)\n"
+        "  --steps <n>                    measured steps (default 600)\n"
+        "  --warmup <n>                   unmeasured steps before timing (default 60)\n"
+        "  --threads <n>                  Engine worker threads (default: hardware)\n"
+        "  --seed <n>                     RNG seed for body placement (default 1)\n",
+        name);
+}
+
+bool parseArgs(int argc, char** argv, Options& opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "-h" || arg == "--help")
+            return false;
+        if(i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        const char* val = argv[++i];
+        if(arg == "--scene")
+            opt.scene = val;
+        else if(arg == "--broadphase")
+            opt.broadphase = val;
+        else if(arg == "--resolve")
+            opt.resolve = val;
+        else if(arg == "--sleep")
+            opt.sleep = std::strcmp(val, "off") != 0;
+        else if(arg == "--warm")
+            opt.warmStarting = std::strcmp(val, "off") != 0;
+        else if(arg == "--deterministic")
+            opt.deterministic = std::strcmp(val, "on") == 0;
+        else if(arg == "--record")
+            opt.record = val;
+        else if(arg == "--trace")
+            opt.trace = val;
+        else if(arg == "--vel-iters")
+            opt.velocityIterations = std::atoi(val);
+        else if(arg == "--pos-iters")
+            opt.positionIterations = std::atoi(val);
+        else if(arg == "--bodies")
+            opt.bodies = std::atoi(val);
+        else if(arg == "--steps")
+            opt.steps = std::atoi(val);
+        else if(arg == "--warmup")
+            opt.warmup = std::atoi(val);
+        else if(arg == "--threads")
+            opt.threads = std::atoi(val);
+        else if(arg == "--seed")
+            opt.seed = std::atoi(val);
+        else
+        {
+            std::cerr << "Unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return opt.bodies >= 0 && opt.velocityIterations >= 0 && opt.positionIterations >= 0 && opt.steps > 0 && opt.warmup >= 0 && opt.threads > 0;
+}
+
+// Registers the same primitive meshes as the debugger (ids 0..4),
+// plus walls sized for a square box of side `side` (ids 5, 6) and the circle (CIRCLE_MESH).
+const int CIRCLE_MESH = 7;
+
+void registerMeshes(float side)
+{
+    meshdata::addBox(Vec2(10, 10));
+    meshdata::addMesh({ Vec2(0, -10), Vec2(10, 10), Vec2(-10, 10) });
+    meshdata::addMesh({
+        Vec2(-20, -20), Vec2(-6, -20), Vec2(16, -10), Vec2(20, 15),
+        Vec2(12, 20), Vec2(-16, 20), Vec2(-20, 16),
+    });
+    meshdata::addMesh({ Vec2(-40, 0), Vec2(40, 20), Vec2(-40, 20) });
+    meshdata::addMesh({ Vec2(-10, -10), Vec2(10, -10), Vec2(20, 10), Vec2(-20, 10) });
+
+    float half = (side - 100) / 2;
+    meshdata::addBox(Vec2(half, 20));
+    meshdata::addBox(Vec2(20, half));
+    meshdata::addCircle(10.0f);
+}
+
+// Walled box of side `side` with `n` bodies laid out on a lattice inside it.
+std::unique_ptr<World> buildScene(const Options& opt)
+{
+    const float spacing = 30.0f;
+    int cols = std::max(1, (int)std::ceil(std::sqrt((float)opt.bodies)));
+    // The walls' inner faces are 125 from the border and the lattice starts 150 in, so it takes
+    // (cols - 1) * spacing plus 150 on both sides
+    float side = std::max(1200.0f, (cols - 1) * spacing + 300.0f);
+
+    registerMeshes(side);
+    auto world = std::make_unique<World>((int)side, (int)side);
+    if(opt.broadphase == "tree")
+        world->setBroadphase(Broadphase::Tree);
+    else if(opt.broadphase == "sap")
+        world->setBroadphase(Broadphase::SweepAndPrune);
+    if(opt.resolve == "islands")
+        world->resolveMode = ResolveMode::Islands;
+    world->sleepEnabled = opt.sleep;
+    world->warmStarting = opt.warmStarting;
+    world->deterministic = opt.deterministic;
+    world->velocityIterations = opt.velocityIterations;
+    world->positionIterations = opt.positionIterations;
+
+    world->addBody(Vec2(side/2, side - 105), 5, 1.0f, 0.0f, 0.2f);
+    world->addBody(Vec2(105, side/2), 6, 1.0f, 0.0f, 0.2f);
+    world->addBody(Vec2(side - 105, side/2), 6, 1.0f, 0.0f, 0.2f);
+
+    std::mt19937 rng(opt.seed);
+    std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+    std::uniform_int_distribution<int> pick(0, 2);
+
+    const int polyMeshes[] = {0, 1, CIRCLE_MESH};
+    for(int i = 0; i < opt.bodies; i++)
+    {
+        int mid;
+        if(opt.scene == "circles")
+            mid = CIRCLE_MESH;
+        else if(opt.scene == "stack")
+            mid = 0;
+        else
+            mid = polyMeshes[pick(rng)];
+
+        float x = 150 + (i % cols) * spacing;
+        float y = side - 150 - (i / cols) * spacing;
+        if(opt.scene == "stack")
+            x = 150 + (i % cols) * spacing * 0.75f, y = side - 135 - (i / cols) * 20.5f;
+        else
+            x += jitter(rng) * 2.0f;
+
+        float r = 10.0f;
+        float mass = r * r;
+        float moi = mass * r * r;
+        world->addBody(Vec2(x, y), Vec2(jitter(rng), jitter(rng)), mid, mass, moi, 1.0f, 0.0f, 0.2f);
+    }
+    return world;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if(opt.scene != "mixed" && opt.scene != "circles" && opt.scene != "stack")
+    {
+        std::cerr << "Unknown scene " << opt.scene << "\n";
+        return 1;
+    }
+    if(opt.broadphase != "grid" && opt.broadphase != "tree" && opt.broadphase != "sap")
+    {
+        std::cerr << "Unknown broadphase " << opt.broadphase << "\n";
+        return 1;
+    }
+    if(opt.resolve != "coloring" && opt.resolve != "islands")
+    {
+        std::cerr << "Unknown resolve mode " << opt.resolve << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<World> world = buildScene(opt);
+    if(!world)
+        return 1;
+
+    Engine engine(opt.threads, world.get());
+    const Vec2 gravity(0.0f, 20.0f);
+
+    FrameRecorder recorder;
+    if(!opt.record.empty() && !recorder.open(opt.record.c_str(), DT))
+    {
+        std::cerr << "Cannot open " << opt.record << "\n";
+        return 1;
+    }
+#ifdef OSMIUM_ALLOC_CHECK
+    uncountedThread.store(recorder.worker.get_id());
+#endif
+
+    Stats update, collision, resolve, total;
+#ifdef OSMIUM_ALLOC_CHECK
+    int allocatingSteps = 0;
+#endif
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    for(int step = 0; step < opt.warmup + opt.steps; step++)
+    {
+        if(step == opt.warmup)
+        {
+            start = clock::now();
+            if(!opt.trace.empty())
+                tracing::start();
+        }
+
+#ifdef OSMIUM_ALLOC_CHECK
+        long allocationsBefore = allocations.load();
+#endif
+        engine.resetForces(gravity);
+        float tu, tc, tr;
+        engine.updateStep(DT, tu, tc, tr);
+
+        if(step < opt.warmup)
+            continue;
+#ifdef OSMIUM_ALLOC_CHECK
+        long stepAllocations = allocations.load() - allocationsBefore;
+        if(stepAllocations > 0)
+        {
+            std::fprintf(stderr, "step %d allocated %ld times\n", step - opt.warmup, stepAllocations);
+            allocatingSteps++;
+        }
+#endif
+        recorder.record(*world);
+        update.add(tu);
+        collision.add(tc);
+        resolve.add(tr);
+        total.add(tu + tc + tr);
+    }
+    recorder.close();
+    double wall = std::chrono::duration<double>(clock::now() - start).count();
+    tracing::stop();
+
+    std::printf("scene %s (%s broadphase): %d bodies (%d active), %d threads, %d steps\n",
+                opt.scene.c_str(), opt.broadphase.c_str(), opt.bodies, world->activeCount, opt.threads, opt.steps);
+    std::printf("last step: %zu intersection pairs, %d collision pairs\n",
+                world->collisionPairs.size(), world->colCnt);
+    std::printf("sleeping bodies: %d\n", world->sleepingCount);
+    std::printf("%-10s %12s %12s %12s\n", "phase", "avg (us)", "min (us)", "max (us)");
+
+    auto row = [&](const char* name, const Stats& s) {
+        std::printf("%-10s %12.2f %12.2f %12.2f\n", name, s.sum / opt.steps, s.mn, s.mx);
+    };
+    row("Update", update);
+    row("Collision", collision);
+    row("Resolve", resolve);
+    row("Total", total);
+    std::printf("throughput: %.1f steps/s\n", opt.steps / wall);
+    if(!opt.record.empty())
+        std::printf("recorded %d frames to %s: %zu bytes (%.2f MB per minute at 60 frames/s)%s\n", opt.steps, opt.record.c_str(),
+                    recorder.bytesWritten, recorder.bytesWritten * 3600.0 / opt.steps / 1e6,
+                    recorder.failed ? " (write error)" : "");
+    if(!opt.trace.empty())
+    {
+        if(tracing::writeChromeTrace(opt.trace.c_str()))
+            std::printf("trace written to %s\n", opt.trace.c_str());
+        else
+            std::fprintf(stderr, "Cannot write %s\n", opt.trace.c_str());
+    }
+
+#ifdef OSMIUM_ALLOC_CHECK
+    if(allocatingSteps > 0)
+    {
+        std::fprintf(stderr, "%d of %d measured steps allocated\n", allocatingSteps, opt.steps);
+        return 1;
+    }
+    std::printf("no allocations in measured steps\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,291 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cassert>
+#include <algorithm>
+#include "structures/AABB.hpp"
+
+// Dynamic AABB tree (bounding volume hierarchy) used as an alternative broadphase.
+// Leaves store fattened AABBs, so a body can move a little without touching the tree.
+// Leaves are inserted next to the sibling that minimizes the surface-area (perimeter) cost,
+// and AVL-style rotations keep the tree balanced after every insert / remove.
+// Proxy ids returned by insert are leaf node indices and stay valid until remove.
+struct AABBTree
+{
+    struct Node
+    {
+        AABB aabb;
+        int parent; // next free node while on the free list
+        int left, right; // -1 for leaves
+        int height; // 0 for leaves, -1 for free nodes
+        int id; // user id stored in leaves
+    };
+
+    std::vector<Node> nodes;
+    int root = -1;
+    int freeList = -1;
+    float margin; // fattening applied to every leaf AABB
+
+    AABBTree(float fatMargin = 4.0f) : margin(fatMargin) {}
+
+    bool isLeaf(int n) const { return nodes[n].left == -1; }
+
+    // Inserts a leaf for `id` with a fattened copy of `aabb`; returns its proxy id.
+    int insert(int id, const AABB& aabb)
+    {
+        int leaf = allocNode();
+        Node& node = nodes[leaf];
+        node.aabb = fatten(aabb);
+        node.id = id;
+        node.height = 0;
+        insertLeaf(leaf);
+        return leaf;
+    }
+
+    void remove(int proxy)
+    {
+        removeLeaf(proxy);
+        freeNode(proxy);
+    }
+
+    // Updates the leaf for a body whose tight AABB is now `aabb`.
+    // The tree is only modified when the AABB escaped the fat AABB; returns whether it was.
+    bool move(int proxy, const AABB& aabb)
+    {
+        if(nodes[proxy].aabb.contains(aabb))
+            return false;
+        removeLeaf(proxy);
+        nodes[proxy].aabb = fatten(aabb);
+        insertLeaf(proxy);
+        return true;
+    }
+
+    // Calls f(id) for every leaf whose fat AABB overlaps `aabb`.
+    template<class F>
+    void query(const AABB& aabb, F&& f) const
+    {
+        if(root == -1 || !nodes[root].aabb.overlaps(aabb))
+            return;
+        // Children are tested before being pushed, so every popped node overlaps `aabb`
+        std::array<int, 256> stack;
+        int top = 0;
+        stack[top++] = root;
+        while(top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            if(node.left == -1)
+            {
+                f(node.id);
+                continue;
+            }
+            assert(top + 2 <= (int)stack.size());
+            if(nodes[node.left].aabb.overlaps(aabb))
+                stack[top++] = node.left;
+            if(nodes[node.right].aabb.overlaps(aabb))
+                stack[top++] = node.right;
+        }
+    }
+
+private:
+    AABB fatten(const AABB& aabb) const
+    {
+        Vec2 r(margin, margin);
+        return AABB(aabb.min - r, aabb.max + r);
+    }
+
+    int allocNode()
+    {
+        int n;
+        if(freeList != -1)
+        {
+            n = freeList;
+            freeList = nodes[n].parent;
+        }
+        else
+        {
+            n = (int)nodes.size();
+            nodes.emplace_back();
+        }
+        nodes[n].parent = nodes[n].left = nodes[n].right = -1;
+        nodes[n].height = 0;
+        nodes[n].id = -1;
+        return n;
+    }
+
+    void freeNode(int n)
+    {
+        nodes[n].parent = freeList;
+        nodes[n].height = -1;
+        freeList = n;
+    }
+
+    // Descends from the root towards the sibling with the lowest perimeter cost
+    // (cost of the new parent plus the enlargement inherited by its ancestors).
+    int findSibling(const AABB& leafAABB) const
+    {
+        int index = root;
+        while(!isLeaf(index))
+        {
+            const Node& node = nodes[index];
+            float area = node.aabb.perimeter();
+            float combined = AABB::merge(node.aabb, leafAABB).perimeter();
+
+            float cost = 2.0f * combined;
+            float inheritance = 2.0f * (combined - area);
+
+            auto childCost = [&](int c) {
+                float merged = AABB::merge(leafAABB, nodes[c].aabb).perimeter();
+                if(isLeaf(c))
+                    return merged + inheritance;
+                return merged - nodes[c].aabb.perimeter() + inheritance;
+            };
+            float cost1 = childCost(node.left);
+            float cost2 = childCost(node.right);
+
+            if(cost < cost1 && cost < cost2)
+                break;
+            index = cost1 < cost2 ? node.left : node.right;
+        }
+        return index;
+    }
+
+    void insertLeaf(int leaf)
+    {
+        if(root == -1)
+        {
+            root = leaf;
+            nodes[root].parent = -1;
+            return;
+        }
+
+        AABB leafAABB = nodes[leaf].aabb;
+        int sibling = findSibling(leafAABB);
+
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].aabb = AABB::merge(leafAABB, nodes[sibling].aabb);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].left = sibling;
+        nodes[newParent].right = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+
+        if(oldParent != -1)
+        {
+            if(nodes[oldParent].left == sibling)
+                nodes[oldParent].left = newParent;
+            else
+                nodes[oldParent].right = newParent;
+        }
+        else
+            root = newParent;
+
+        refit(nodes[leaf].parent);
+    }
+
+    void removeLeaf(int leaf)
+    {
+        if(leaf == root)
+        {
+            root = -1;
+            return;
+        }
+
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+        if(grandParent != -1)
+        {
+            if(nodes[grandParent].left == parent)
+                nodes[grandParent].left = sibling;
+            else
+                nodes[grandParent].right = sibling;
+            nodes[sibling].parent = grandParent;
+            freeNode(parent);
+            refit(grandParent);
+        }
+        else
+        {
+            root = sibling;
+            nodes[sibling].parent = -1;
+            freeNode(parent);
+        }
+    }
+
+    // Walks from `index` to the root, rebalancing and recomputing heights and AABBs.
+    void refit(int index)
+    {
+        while(index != -1)
+        {
+            index = balance(index);
+            Node& node = nodes[index];
+            const Node& l = nodes[node.left];
+            const Node& r = nodes[node.right];
+            node.height = 1 + std::max(l.height, r.height);
+            node.aabb = AABB::merge(l.aabb, r.aabb);
+            index = node.parent;
+        }
+    }
+
+    // Performs a left or right rotation if node `a` is imbalanced; returns the new subtree root.
+    int balance(int a)
+    {
+        Node& A = nodes[a];
+        if(A.left == -1 || A.height < 2)
+            return a;
+
+        int b = A.left;
+        int c = A.right;
+        int bal = nodes[c].height - nodes[b].height;
+
+        if(bal > 1)
+            return rotate(a, c, b);
+        if(bal < -1)
+            return rotate(a, b, c);
+        return a;
+    }
+
+    // Promotes child `up` of `a` (the taller one) above `a`; `other` is a's remaining child.
+    int rotate(int a, int up, int other)
+    {
+        Node& A = nodes[a];
+        Node& U = nodes[up];
+        int f = U.left;
+        int g = U.right;
+
+        // Swap a and up
+        U.left = a;
+        U.parent = A.parent;
+        A.parent = up;
+
+        if(U.parent != -1)
+        {
+            if(nodes[U.parent].left == a)
+                nodes[U.parent].left = up;
+            else
+                nodes[U.parent].right = up;
+        }
+        else
+            root = up;
+
+        // Keep the taller grandchild under `up`, hand the shorter one to `a`
+        int keep = f, give = g;
+        if(nodes[f].height < nodes[g].height)
+            keep = g, give = f;
+
+        U.right = keep;
+        if(A.left == up)
+            A.left = give;
+        else
+            A.right = give;
+        nodes[give].parent = a;
+
+        A.aabb = AABB::merge(nodes[other].aabb, nodes[give].aabb);
+        A.height = 1 + std::max(nodes[other].height, nodes[give].height);
+        U.aabb = AABB::merge(A.aabb, nodes[keep].aabb);
+        U.height = 1 + std::max(A.height, nodes[keep].height);
+        return up;
+    }
+};
@@ -1,19 +1,55 @@
 #pragma once
-#include <array>
 #include <vector>
+#include <span>
 #include <cmath>
+#include <cstdint>
+#include <bit>
+#include <algorithm>
 
-//Maximum number of cells in QuadGrid
-inline const int MAXSZ = 1<<18;
-
-struct QuadGrid 
+// Sparse multi-level grid used by the broadphase.
+// Only occupied cells exist: they are found through an open-addressing hash table keyed on
+// (level, x, y), and their body ids live in one flat arena (`pool`), carved into power-of-two
+// blocks that are recycled through per-size free lists. Memory scales with occupied cells.
+// Cell ids returned by getIndex / insert stay valid while the cell is non-empty.
+//
+// The grid is unbounded: `length` only sets the size of a level-0 cell, and cell coordinates
+// may be negative or arbitrarily far away (they are clamped to the packable range, which only
+// makes far-away bodies share border cells). Bodies larger than a level-0 cell go to a single
+// overflow cell at level `overflowLevel` that every query scans.
+struct QuadGrid
 {
+    struct Cell
+    {
+        uint64_t key;
+        int offset; // first slot of the cell's block in `pool`
+        int count;
+        int sizeClass; // block capacity is 1 << sizeClass
+    };
+
+    struct Entry
+    {
+        uint64_t key;
+        int cell; // -1 for empty hash slots
+    };
+
     int limit; //minimum cell size (in world units) for stopping the level subdivision
-    int length; //smallest power-of-two length that covers the world extents
+    int length; //level-0 cell size: smallest power-of-two length that covers the given world size
+    int numLevels;
+    int overflowLevel; // == numLevels; holds bodies larger than a level-0 cell
 
-    std::array<std::vector<int>, MAXSZ> grid; 
-    std::vector<int> levels; //level base indices (levels[i] = start index of level i in flat grid array)
-    std::vector<int> occ; // occupancy flag per level
+    std::vector<int> occ; // number of bodies per level (including overflowLevel)
+
+    std::vector<Entry> table; // open addressing, linear probing, power-of-two capacity, load <= 1/4
+    int tableUsed = 0;
+    int tableShift = 64 - 6;
+    std::vector<Cell> cells;
+    std::vector<int> freeCells;
+    std::vector<int> pool;
+    std::vector<std::vector<int>> freeBlocks; // freeBlocks[c] = offsets of free blocks of size 1 << c
+
+    static constexpr int MIN_CLASS = 2;
+    static constexpr int POOL_PER_BODY = 4; // arena slots reserved per body: block rounding and recycled blocks
+    static constexpr int COORD_LIMIT = 1 << 28; // cell coordinates are clamped to [-COORD_LIMIT, COORD_LIMIT)
 
     QuadGrid(int worldSize, int lim = 16)
     {
@@ -21,35 +57,121 @@ struct QuadGrid
         length = 1;
         while(length < worldSize)
             length <<= 1;
-        
-        int cnt = 1;
-        int ind = 0;
+
+        numLevels = 0;
         int tmp = length;
         while(tmp >= lim)
         {
-            levels.push_back(ind);
             occ.push_back(0);
-            ind += cnt;
-            cnt *= 4;
+            numLevels++;
             tmp >>= 1;
         }
+        overflowLevel = numLevels;
+        occ.push_back(0);
+        table.assign(64, {0, -1});
+    }
+
+    // Makes room for `bodies` entries: at most one cell per body, POOL_PER_BODY arena slots per body,
+    // and every free list can take all the blocks of its size the reserved arena holds.
+    void reserve(int bodies)
+    {
+        cells.reserve(bodies);
+        freeCells.reserve(bodies);
+        pool.reserve((size_t)POOL_PER_BODY * bodies);
+        int classes = std::bit_width(pool.capacity());
+        if((int)freeBlocks.size() < classes)
+            freeBlocks.resize(classes);
+        for(int c = MIN_CLASS; c < classes; c++)
+            freeBlocks[c].reserve(pool.capacity() >> c);
+    }
+
+    static uint64_t makeKey(int lvl, int x, int y)
+    {
+        return ((uint64_t)lvl << 58) | ((uint64_t)(uint32_t)x & 0x1FFFFFFF) << 29 | ((uint64_t)(uint32_t)y & 0x1FFFFFFF);
+    }
+
+    // Fibonacci hashing: the high bits of key * 2^64/phi, reduced to the table size
+    size_t slotOf(uint64_t key) const
+    {
+        return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> tableShift);
+    }
+
+    // Get id of an occupied grid cell, or -1 if the cell is empty
+    int getIndex(int lvl, int x, int y) const
+    {
+        uint64_t key = makeKey(lvl, x, y);
+        size_t mask = table.size() - 1;
+        for(size_t i = slotOf(key); ; i = (i + 1) & mask)
+        {
+            if(table[i].cell == -1)
+                return -1;
+            if(table[i].key == key)
+                return table[i].cell;
+        }
+    }
+
+    // Body ids stored in cell `ind`
+    std::span<const int> cell(int ind) const
+    {
+        const Cell& c = cells[ind];
+        return std::span<const int>(pool.data() + c.offset, c.count);
+    }
+
+    // Decodes the level and grid coordinates of cell `ind`
+    void cellCoord(int ind, int& lvl, int& x, int& y) const
+    {
+        uint64_t key = cells[ind].key;
+        lvl = (int)(key >> 58);
+        // sign-extend the 29-bit coordinates
+        x = (int32_t)((uint32_t)(key >> 29) << 3) >> 3;
+        y = (int32_t)((uint32_t)key << 3) >> 3;
     }
 
-    // Get index of a specific grid cell
-    int getIndex(int lvl, int x, int y)
+    // Whether cell `ind` is the cell (lvl, x, y)
+    bool isCell(int ind, int lvl, int x, int y) const
     {
-        int cnt = 1<<lvl;
-        if(x < 0 || x >= cnt || y < 0 || y >= cnt)
+        return ind >= 0 && cells[ind].key == makeKey(lvl, x, y);
+    }
+
+    // Appends `id` to cell (lvl, x, y), creating the cell if needed.
+    // Stores the cell id in `ind` and returns the slot of `id` inside the cell.
+    int insert(int lvl, int x, int y, int id, int& ind)
+    {
+        occ[lvl]++;
+        ind = findOrCreate(makeKey(lvl, x, y));
+        Cell& c = cells[ind];
+        if(c.count == (1 << c.sizeClass))
+            grow(c);
+        pool[c.offset + c.count] = id;
+        return c.count++;
+    }
+
+    // Swap-removes the entry at `slot` of cell `ind` in O(1); empty cells are released.
+    // Returns the id that was moved into `slot`, or -1 if the removed entry was the last one.
+    int remove(int lvl, int ind, int slot)
+    {
+        occ[lvl]--;
+        Cell& c = cells[ind];
+        int last = pool[c.offset + --c.count];
+        if(c.count == 0)
+        {
+            release(ind);
+            return -1;
+        }
+        if(slot == c.count)
             return -1;
-        return levels[lvl] + y * (1<<lvl) + x;
+        pool[c.offset + slot] = last;
+        return last;
     }
 
-    //Get smallest level greater than sz
-    int getLevel(float sz)
+    //Get smallest level greater than sz (overflowLevel if sz exceeds a level-0 cell)
+    int getLevel(float sz) const
     {
+        if(sz > length)
+            return overflowLevel;
         int lvl = 0;
         int curr = length;
-        while(lvl < (int)levels.size()-1 && (curr >> 1) >= sz)
+        while(lvl < numLevels-1 && (curr >> 1) >= sz)
         {
             curr >>= 1;
             lvl++;
@@ -57,11 +179,129 @@ struct QuadGrid
         return lvl;
     }
 
-    //Convert world coordinates to grid coordinates
-    void gridCoord(int& gx, int& gy, int lvl, float x, float y)
+    //Convert world coordinates to grid coordinates (always (0, 0) on overflowLevel)
+    void gridCoord(int& gx, int& gy, int lvl, float x, float y) const
     {
+        if(lvl == overflowLevel)
+        {
+            gx = gy = 0;
+            return;
+        }
         int curr = length >> lvl;
-        gx = (int)floor(x / curr);
-        gy = (int)floor(y / curr);
+        gx = clampCoord(std::floor(x / curr));
+        gy = clampCoord(std::floor(y / curr));
+    }
+
+    // Branchless clamp; std::max(lo, NaN) yields lo, so NaN maps to the lower border
+    static int clampCoord(float c)
+    {
+        return (int)std::min(std::max((float)-COORD_LIMIT, c), (float)(COORD_LIMIT - 1));
+    }
+
+private:
+    int findOrCreate(uint64_t key)
+    {
+        size_t mask = table.size() - 1;
+        size_t i = slotOf(key);
+        for(; table[i].cell != -1; i = (i + 1) & mask)
+            if(table[i].key == key)
+                return table[i].cell;
+
+        int ind;
+        if(!freeCells.empty())
+        {
+            ind = freeCells.back();
+            freeCells.pop_back();
+        }
+        else
+        {
+            ind = (int)cells.size();
+            cells.emplace_back();
+        }
+        cells[ind] = {key, allocBlock(MIN_CLASS), 0, MIN_CLASS};
+        table[i] = {key, ind};
+        if(++tableUsed * 4 > (int)table.size())
+            rehash(table.size() * 2);
+        return ind;
+    }
+
+    // Removes the cell from the hash table (backward-shift deletion) and frees its block.
+    void release(int ind)
+    {
+        Cell& c = cells[ind];
+        freeBlock(c.offset, c.sizeClass);
+        freeCells.push_back(ind);
+
+        size_t mask = table.size() - 1;
+        size_t i = slotOf(c.key);
+        while(table[i].key != c.key || table[i].cell != ind)
+            i = (i + 1) & mask;
+        size_t j = i;
+        while(true)
+        {
+            j = (j + 1) & mask;
+            if(table[j].cell == -1)
+                break;
+            size_t home = slotOf(table[j].key);
+            // Move table[j] into the hole at i unless its home lies cyclically in (i, j]
+            bool between = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+            if(!between)
+            {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i].cell = -1;
+        tableUsed--;
+    }
+
+    void rehash(size_t cap)
+    {
+        std::vector<Entry> old;
+        old.swap(table);
+        table.assign(cap, {0, -1});
+        tableShift = 64 - std::countr_zero(cap);
+        size_t mask = cap - 1;
+        for(const Entry& e: old)
+        {
+            if(e.cell == -1)
+                continue;
+            size_t i = slotOf(e.key);
+            while(table[i].cell != -1)
+                i = (i + 1) & mask;
+            table[i] = e;
+        }
+    }
+
+    int allocBlock(int sizeClass)
+    {
+        if((int)freeBlocks.size() <= sizeClass)
+            freeBlocks.resize(sizeClass + 1);
+        std::vector<int>& fl = freeBlocks[sizeClass];
+        if(!fl.empty())
+        {
+            int off = fl.back();
+            fl.pop_back();
+            return off;
+        }
+        int off = (int)pool.size();
+        pool.resize(pool.size() + (1 << sizeClass));
+        return off;
+    }
+
+    void freeBlock(int offset, int sizeClass)
+    {
+        freeBlocks[sizeClass].push_back(offset);
+    }
+
+    // Moves a full cell into a block twice as large
+    void grow(Cell& c)
+    {
+        int off = allocBlock(c.sizeClass + 1);
+        for(int k = 0; k < c.count; k++)
+            pool[off + k] = pool[c.offset + k];
+        freeBlock(c.offset, c.sizeClass);
+        c.offset = off;
+        c.sizeClass++;
     }
 };
@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "structures/AABB.hpp"
+
+// Incremental sort-and-sweep broadphase with temporal coherence.
+// AABB endpoints are kept sorted on both axes across steps and re-sorted with insertion sort,
+// which is near-linear when bodies barely move. Every swap of a min past a max changes whether
+// two intervals overlap on that axis, so the persistent pair list is edited through add / remove
+// events instead of being rebuilt each step. Touching AABBs count as overlapping, as in AABB::overlaps.
+struct SweepAndPrune
+{
+    // Pair key -> index in `pairs`. Open addressing with linear probing and backward-shift deletion,
+    // kept at most half full. The slot array only grows, so a steady state does not allocate.
+    struct PairIndex
+    {
+        static constexpr uint64_t EMPTY = ~(uint64_t)0;
+        std::vector<uint64_t> keys;
+        std::vector<int> values;
+        int count = 0;
+
+        static uint64_t hash(uint64_t key)
+        {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            return key ^ (key >> 33);
+        }
+
+        // Slot holding `key`, or the empty slot where it would go
+        int slot(uint64_t key) const
+        {
+            int mask = (int)keys.size() - 1;
+            int i = (int)(hash(key) & mask);
+            while(keys[i] != key && keys[i] != EMPTY)
+                i = (i + 1) & mask;
+            return i;
+        }
+
+        int* find(uint64_t key)
+        {
+            if(keys.empty())
+                return nullptr;
+            int i = slot(key);
+            return keys[i] == key ? &values[i] : nullptr;
+        }
+
+        // Returns false (and leaves the value alone) if `key` is already present
+        bool insert(uint64_t key, int value)
+        {
+            if(2 * (count + 1) > (int)keys.size())
+                grow();
+            int i = slot(key);
+            if(keys[i] == key)
+                return false;
+            keys[i] = key;
+            values[i] = value;
+            count++;
+            return true;
+        }
+
+        void erase(uint64_t key)
+        {
+            if(keys.empty())
+                return;
+            int mask = (int)keys.size() - 1;
+            int i = slot(key);
+            if(keys[i] != key)
+                return;
+            // Shift later entries of the probe run back into the hole
+            for(int j = (i + 1) & mask; keys[j] != EMPTY; j = (j + 1) & mask)
+            {
+                int home = (int)(hash(keys[j]) & mask);
+                if(((j - home) & mask) >= ((j - i) & mask))
+                {
+                    keys[i] = keys[j];
+                    values[i] = values[j];
+                    i = j;
+                }
+            }
+            keys[i] = EMPTY;
+            count--;
+        }
+
+        // Grows the slot array until `n` keys fit
+        void reserve(int n)
+        {
+            while(2 * n > (int)keys.size())
+                grow();
+        }
+
+        void grow()
+        {
+            std::vector<uint64_t> oldKeys(std::max<size_t>(64, 2 * keys.size()), EMPTY);
+            std::vector<int> oldValues(oldKeys.size());
+            oldKeys.swap(keys);
+            oldValues.swap(values);
+            for(size_t i = 0; i < oldKeys.size(); i++)
+                if(oldKeys[i] != EMPTY)
+                {
+                    int j = slot(oldKeys[i]);
+                    keys[j] = oldKeys[i];
+                    values[j] = oldValues[i];
+                }
+        }
+    };
+
+    struct Endpoint
+    {
+        float value;
+        int handle; // body id << 1 | isMax
+    };
+
+    std::vector<Endpoint> axis[2];
+    std::vector<std::pair<int, int>> pairs; // currently overlapping pairs, first < second
+    PairIndex pairIndex;
+
+    // Adds the endpoints of body `id`. They are appended past the end of the arrays,
+    // i.e. the body starts out separated from everything, and find their place in the next update.
+    void insert(int id)
+    {
+        for(auto& ax: axis)
+        {
+            ax.push_back({0.0f, id << 1});
+            ax.push_back({0.0f, id << 1 | 1});
+        }
+    }
+
+    // Makes room for `pairCount` overlapping pairs, so the pair list and index do not grow below it
+    void reserve(int pairCount)
+    {
+        pairs.reserve(pairCount);
+        pairIndex.reserve(pairCount);
+    }
+
+    void remove(int id)
+    {
+        remove(id, [](int) {});
+    }
+
+    // Removes the endpoints of body `id` and every pair that contains it, calling onPartner(id2)
+    // with the other body of each of those pairs. O(n + pairs).
+    template<class F>
+    void remove(int id, F&& onPartner)
+    {
+        for(auto& ax: axis)
+        {
+            int w = 0;
+            for(const Endpoint& e: ax)
+                if((e.handle >> 1) != id)
+                    ax[w++] = e;
+            ax.resize(w);
+        }
+        for(int i = 0; i < (int)pairs.size(); )
+        {
+            if(pairs[i].first == id || pairs[i].second == id)
+            {
+                onPartner(pairs[i].first == id ? pairs[i].second : pairs[i].first);
+                removePair(pairs[i].first, pairs[i].second);
+            }
+            else
+                i++;
+        }
+    }
+
+    // Refreshes endpoint values from `aabbs` and re-sorts both axes, updating `pairs`.
+    // `active` is used to skip static-static pairs.
+    void update(const AABB* aabbs, const int* active)
+    {
+        for(int a = 0; a < 2; a++)
+        {
+            std::vector<Endpoint>& ax = axis[a];
+            for(Endpoint& e: ax)
+            {
+                const AABB& box = aabbs[e.handle >> 1];
+                const Vec2& p = (e.handle & 1) ? box.max : box.min;
+                e.value = a == 0 ? p.x : p.y;
+            }
+            sortAxis(ax, aabbs, active);
+        }
+    }
+
+private:
+    static uint64_t pairKey(int a, int b)
+    {
+        return (uint64_t)(uint32_t)a << 32 | (uint32_t)b;
+    }
+
+    // Sort order: by value, mins before maxes on ties so that touching intervals overlap
+    static bool less(const Endpoint& a, const Endpoint& b)
+    {
+        return a.value < b.value || (a.value == b.value && (a.handle & 1) < (b.handle & 1));
+    }
+
+    void sortAxis(std::vector<Endpoint>& ax, const AABB* aabbs, const int* active)
+    {
+        for(int i = 1; i < (int)ax.size(); i++)
+        {
+            Endpoint e = ax[i];
+            int j = i - 1;
+            for(; j >= 0 && less(e, ax[j]); j--)
+            {
+                const Endpoint& f = ax[j];
+                int id1 = e.handle >> 1, id2 = f.handle >> 1;
+                bool eMax = e.handle & 1, fMax = f.handle & 1;
+                // A min moving left past a max starts an overlap on this axis, a max moving
+                // left past a min ends one. The other axis is checked on the final AABBs.
+                if(!eMax && fMax)
+                {
+                    if(!(active[id1] == 2 && active[id2] == 2) && aabbs[id1].overlaps(aabbs[id2]))
+                        addPair(id1, id2);
+                }
+                else if(eMax && !fMax)
+                    removePair(id1, id2);
+                ax[j + 1] = f;
+            }
+            ax[j + 1] = e;
+        }
+    }
+
+    // Idempotent: a pair that starts overlapping on both axes in one step is reported twice
+    void addPair(int a, int b)
+    {
+        if(a > b)
+            std::swap(a, b);
+        if(pairIndex.insert(pairKey(a, b), (int)pairs.size()))
+            pairs.emplace_back(a, b);
+    }
+
+    // Swap-removes the pair from `pairs` if present
+    void removePair(int a, int b)
+    {
+        if(a > b)
+            std::swap(a, b);
+        uint64_t key = pairKey(a, b);
+        int* index = pairIndex.find(key);
+        if(!index)
+            return;
+        int i = *index;
+        pairIndex.erase(key);
+        if(i != (int)pairs.size() - 1)
+        {
+            pairs[i] = pairs.back();
+            *pairIndex.find(pairKey(pairs[i].first, pairs[i].second)) = i;
+        }
+        pairs.pop_back();
+    }
+};
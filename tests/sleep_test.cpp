@@ -0,0 +1,51 @@
+#include <cstdio>
+#include "engine/Engine.hpp"
+
+// A lone body thrown straight up slows below the sleep thresholds around the top of its flight.
+// It must keep flying (no contact, no sleep), then come to rest and fall asleep on the floor.
+
+const float DT = 0.016f;
+
+bool throwAndLand(int mesh, float gravity)
+{
+    World world(1000, 1000);
+    world.addBody(Vec2(0, 400), meshdata::addBox(Vec2(500, 20)), 1.0f, 0.0f, 0.2f);
+    int id = world.addBody(Vec2(0, 300), Vec2(0, -100), mesh, 100.0f, 10000.0f, 1.0f, 0.0f, 0.2f);
+    Engine engine(1, &world);
+
+    float apex = 300;
+    for(int step = 0; step < 2000; step++)
+    {
+        engine.resetForces(Vec2(0, gravity));
+        float tu, tc, tr;
+        engine.updateStep(DT, tu, tc, tr);
+        Vec2 p = world.bodies.position[id];
+        apex = std::min(apex, p.y);
+        if(world.bodies.active[id] == 3)
+        {
+            // Resting on the floor (top at y = 380) is the only place it may sleep
+            if(p.y < 360)
+            {
+                std::printf("mesh %d, gravity %.0f: asleep in the air at step %d, y = %.1f\n", mesh, gravity, step, p.y);
+                return false;
+            }
+            return true;
+        }
+    }
+    std::printf("mesh %d, gravity %.0f: never fell asleep on the floor (apex y = %.1f)\n", mesh, gravity, apex);
+    return false;
+}
+
+int main()
+{
+    int circle = meshdata::addCircle(10.0f);
+    int box = meshdata::addBox(Vec2(10, 10));
+    bool ok = true;
+    for(float g: {20.0f, 15.0f})
+    {
+        ok &= throwAndLand(circle, g);
+        ok &= throwAndLand(box, g);
+    }
+    std::printf(ok ? "sleep test passed\n" : "sleep test failed\n");
+    return ok ? 0 : 1;
+}
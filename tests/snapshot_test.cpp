@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cstddef>
+#include <functional>
+#include "engine/Engine.hpp"
+
+// restore() must reject a blob whose index fields (body state, mesh id, freeList entry, manifold
+// key) are out of range, and leave the world as it was.
+
+const float DT = 0.016f;
+
+int failures = 0;
+
+void check(bool ok, const char* what)
+{
+    if(!ok)
+    {
+        std::printf("%s\n", what);
+        failures++;
+    }
+}
+
+// Byte offset in the blob of body `id`'s entry in the array `field` of the storage
+size_t arrayOffset(World& world, const World::SnapshotHeader& h, const void* field, size_t id)
+{
+    size_t offset = sizeof(h), at = 0;
+    World::snapshotArrays(world.bodies, [&](const auto& v) {
+        if((const void*)&v == field)
+            at = offset + id * sizeof(v[0]);
+        offset += h.allocated * sizeof(v[0]);
+    });
+    return at;
+}
+
+template<class T>
+void poke(std::vector<uint8_t>& blob, size_t offset, const T& value)
+{
+    std::memcpy(blob.data() + offset, &value, sizeof(T));
+}
+
+// Restoring `blob` after `corrupt` must fail without touching the world
+void expectRejected(World& world, const std::vector<uint8_t>& blob, const char* what,
+    const std::function<void(std::vector<uint8_t>&, const World::SnapshotHeader&)>& corrupt)
+{
+    World::SnapshotHeader h;
+    std::memcpy(&h, blob.data(), sizeof(h));
+    std::vector<uint8_t> bad = blob;
+    corrupt(bad, h);
+    std::vector<uint8_t> before, after;
+    world.snapshot(before);
+    check(!world.restore(bad.data(), bad.size()), what);
+    world.snapshot(after);
+    check(before == after, "a rejected restore changed the world");
+}
+
+int main()
+{
+    World world(1000, 1000);
+    int box = meshdata::addBox(Vec2(10, 10));
+    int circle = meshdata::addCircle(10.0f);
+    world.addBody(Vec2(0, 400), meshdata::addBox(Vec2(500, 20)), 1.0f, 0.0f, 0.2f);
+    for(int i = 0; i < 6; i++)
+        world.addBody(Vec2(-60 + 20 * i, 360), Vec2(0, 0), i % 2 ? box : circle, 100.0f, 10000.0f, 1.0f, 0.0f, 0.2f);
+    world.deleteBody(3);
+    Engine engine(1, &world);
+    for(int step = 0; step < 30; step++)
+    {
+        engine.resetForces(Vec2(0, 20));
+        float tu, tc, tr;
+        engine.updateStep(DT, tu, tc, tr);
+    }
+
+    std::vector<uint8_t> blob;
+    world.snapshot(blob);
+    World::SnapshotHeader h;
+    std::memcpy(&h, blob.data(), sizeof(h));
+    check(h.freeCount == 1 && h.manifoldCount > 0, "scene should have a free id and contacts");
+    check(world.restore(blob.data(), blob.size()), "restoring an intact blob failed");
+
+    size_t freeAt = blob.size() - h.manifoldCount * sizeof(CachedManifold) - h.freeCount * sizeof(int);
+    size_t manifoldAt = blob.size() - h.manifoldCount * sizeof(CachedManifold);
+    const void* active = &world.bodies.active;
+    const void* info = &world.bodies.info;
+
+    expectRejected(world, blob, "accepted a body state of 7", [&](auto& b, auto& h) {
+        poke(b, arrayOffset(world, h, active, 2), 7); });
+    expectRejected(world, blob, "accepted a negative mesh id", [&](auto& b, auto& h) {
+        poke(b, arrayOffset(world, h, info, 2) + offsetof(BodyInfo, meshID), -1); });
+    expectRejected(world, blob, "accepted an unregistered mesh id", [&](auto& b, auto& h) {
+        poke(b, arrayOffset(world, h, info, 2) + offsetof(BodyInfo, meshID), (int)meshdata::meshes.size()); });
+    expectRejected(world, blob, "accepted a mesh id of another shape type", [&](auto& b, auto& h) {
+        poke(b, arrayOffset(world, h, info, 2) + offsetof(BodyInfo, meshID), circle); });
+    expectRejected(world, blob, "accepted a freeList entry past the bodies", [&](auto& b, auto&) {
+        poke(b, freeAt, h.allocated); });
+    expectRejected(world, blob, "accepted a live body in freeList", [&](auto& b, auto&) {
+        poke(b, freeAt, 2); });
+    expectRejected(world, blob, "accepted a manifold key past the bodies", [&](auto& b, auto&) {
+        poke(b, manifoldAt + offsetof(CachedManifold, key), (uint64_t)h.allocated << 32); });
+
+    std::printf(failures ? "snapshot test failed\n" : "snapshot test passed\n");
+    return failures ? 1 : 0;
+}